@@ -1,4 +1,3 @@
- 
 // Base64 encoding (RFC1341)
 // Copyright (c) 2005-2011, Jouni Malinen <j@w1.fi>
 // 
@@ -12,34 +11,38 @@
 //	changed naming conventions to match project
 // source: https://stackoverflow.com/questions/342409/how-do-i-base64-encode-decode-in-c
 
+// 11 2019, Erik Maldonado: 
+//	added ssse3 and avx2 encoders picked at runtime, caller supplied buffers and a decoder
+// source: http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+
 // std
 #include <string>
+#include <vector>
+
+// simd
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define BASE64_TARGET(isa)
+#else
+#define BASE64_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
 
 // custom
 #include "base64.h"
+#include "simd.h"
+#include "trace.h"
 
 // assumptions:
-//	input: data to be encoded is not empty
-//	input_length: length of the data to be encoded
-// output: string containing encoded data or empty string on failure
-std::string base64_encode(const unsigned char *input, size_t input_length)
+//	input: input_length bytes, a multiple of 3 unless it is the final block
+//	output: room for the encoding of input
+// outcome: returns the end of the encoded data written to output
+static char* encode_scalar(const unsigned char* input, size_t input_length, char* output)
 {
-	unsigned char *p_output, *p_position;
-	const unsigned char *p_end, *p_input;
-	
-	// 3-byte blocks to 4-byte
-	size_t output_length = 4 * ((input_length + 2) / 3);
-	
-	// return empty string on potential integer overflow
-	if (output_length < input_length) return std::string();
-
-	std::string output;
-	output.resize(output_length);
-	p_output = (unsigned char*)&output[0];
-
-	p_end = input + input_length;
-	p_input = input;
-	p_position = p_output;
+	const unsigned char *p_end = input + input_length, *p_input = input;
+	unsigned char* p_position = reinterpret_cast<unsigned char*>(output);
 
 	while (p_end - p_input >= 3)
 	{
@@ -65,5 +68,197 @@ std::string base64_encode(const unsigned char *input, size_t input_length)
 		}
 		*p_position++ = '=';
 	}
+	return reinterpret_cast<char*>(p_position);
+}
+
+#if defined(BASE64_X86)
+// vector versions work on 12 bytes per 128 bit lane: the bytes are spread so every 32 bit word holds
+// one 3 byte group, the four 6 bit indices are moved into their own bytes with two multiplies and
+// mapped to ascii by adding a per range offset picked with a byte shuffle
+
+// outcome: returns the 6 bit indices of every 3 byte group of input as bytes
+BASE64_TARGET("ssse3")
+static inline __m128i split_ssse3(__m128i input)
+{
+	input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+	const __m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	const __m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+
+	return _mm_or_si128(high, low);
+}
+
+// outcome: returns the ascii characters of 6 bit indices
+BASE64_TARGET("ssse3")
+static inline __m128i lookup_ssse3(__m128i indices)
+{
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, 
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	// 0-25 map to 13, 26-51 to 0 and 52-63 to 1-12 which selects the offset of each range
+	__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+
+	return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+// outcome: returns the end of the encoded data, at most 4 input bytes are left for the scalar tail
+BASE64_TARGET("ssse3")
+static char* encode_ssse3(const unsigned char*& input, size_t& input_length, char* output)
+{
+	// every load reads 16 bytes and consumes 12
+	while (input_length >= 16)
+	{
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), lookup_ssse3(split_ssse3(block)));
+
+		input += 12;
+		input_length -= 12;
+		output += 16;
+	}
+	return output;
+}
+
+BASE64_TARGET("avx2")
+static inline __m256i split_avx2(__m256i input)
+{
+	input = _mm256_shuffle_epi8(input, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+	const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+	const __m256i low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+
+	return _mm256_or_si256(high, low);
+}
+
+BASE64_TARGET("avx2")
+static inline __m256i lookup_avx2(__m256i indices)
+{
+	const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+	range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+
+	return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+}
+
+// outcome: returns the end of the encoded data, the rest is left for the ssse3 and scalar tails
+BASE64_TARGET("avx2")
+static char* encode_avx2(const unsigned char*& input, size_t& input_length, char* output)
+{
+	// both lanes read 16 bytes and consume 12, the upper lane starts 12 bytes in
+	while (input_length >= 28)
+	{
+		const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+		const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 12));
+		const __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(output), lookup_avx2(split_avx2(block)));
+
+		input += 24;
+		input_length -= 24;
+		output += 32;
+	}
 	return output;
-}
\ No newline at end of file
+}
+#endif
+
+// outcome: returns the length of the encoding of input_length bytes, 0 on potential integer overflow
+size_t base64_encoded_length(size_t input_length)
+{
+	// 3-byte blocks to 4-byte
+	size_t output_length = 4 * ((input_length + 2) / 3);
+
+	return output_length < input_length ? 0 : output_length;
+}
+
+// assumptions:
+//	input: data to be encoded
+//	input_length: length of the data to be encoded
+//	output: caller owned buffer of at least base64_encoded_length(input_length) bytes
+// output: encoded data written to output, returns the number of bytes written
+size_t base64_encode(const unsigned char* input, size_t input_length, char* output)
+{
+	TraceScope trace("base64_encode", input_length);
+	char* p_position = output;
+
+#if defined(BASE64_X86)
+	if (simd_level() >= SIMD_AVX2) p_position = encode_avx2(input, input_length, p_position);
+	if (simd_level() >= SIMD_SSSE3) p_position = encode_ssse3(input, input_length, p_position);
+#endif
+
+	const size_t output_length = encode_scalar(input, input_length, p_position) - output;
+	trace.bytes_out(output_length);
+
+	return output_length;
+}
+
+// assumptions:
+//	input: data to be encoded
+//	input_length: length of the data to be encoded
+//	output: buffer reused between calls, its capacity is kept
+// output: output holds the encoded data, returns its length or 0 on failure
+size_t base64_encode(const unsigned char* input, size_t input_length, std::string& output)
+{
+	size_t output_length = base64_encoded_length(input_length);
+
+	output.resize(output_length);
+	if (output_length == 0) return 0;
+
+	return base64_encode(input, input_length, &output[0]);
+}
+
+// assumptions:
+//	input: data to be encoded is not empty
+//	input_length: length of the data to be encoded
+// output: string containing encoded data or empty string on failure
+std::string base64_encode(const unsigned char *input, size_t input_length)
+{
+	std::string output;
+	base64_encode(input, input_length, output);
+	return output;
+}
+
+// assumptions:
+//	input: base64 encoded data with padding, as written by base64_encode
+//	input_length: length of the encoded data
+// output: output holds the decoded data, returns false when input is not valid base64
+bool base64_decode(const char* input, size_t input_length, std::vector<unsigned char>& output)
+{
+	// maps ascii to 6 bit values, 0x80 marks characters outside the alphabet
+	static const std::vector<unsigned char> decode_table = []()
+	{
+		std::vector<unsigned char> table(256, 0x80);
+		for (unsigned char i = 0; i < 64; i++) table[base64_table[i]] = i;
+		return table;
+	}();
+
+	output.clear();
+	if (input_length % 4 != 0) return false;
+	if (input_length == 0) return true;
+
+	const unsigned char* p_input = reinterpret_cast<const unsigned char*>(input);
+	const size_t padding = (p_input[input_length - 1] == '=') + (p_input[input_length - 2] == '=');
+
+	output.resize(input_length / 4 * 3 - padding);
+	unsigned char* p_output = output.data();
+
+	for (size_t i = 0; i < input_length; i += 4)
+	{
+		const bool last = i + 4 == input_length;
+		const unsigned char a = decode_table[p_input[i]], b = decode_table[p_input[i + 1]];
+		const unsigned char c = last && padding >= 2 ? 0 : decode_table[p_input[i + 2]];
+		const unsigned char d = last && padding >= 1 ? 0 : decode_table[p_input[i + 3]];
+
+		if ((a | b | c | d) & 0x80) return false;
+
+		const unsigned int group = (a << 18) | (b << 12) | (c << 6) | d;
+
+		*p_output++ = static_cast<unsigned char>(group >> 16);
+		if (!last || padding < 2) *p_output++ = static_cast<unsigned char>(group >> 8);
+		if (!last || padding < 1) *p_output++ = static_cast<unsigned char>(group);
+	}
+	return true;
+}
@@ -1,16 +1,39 @@
-
 // 11 2019, Erik Maldonado
 
 #pragma once
 
 // std
 #include <string>
+#include <vector>
 
 static const unsigned char base64_table[65] =
 "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+// outcome: returns the length of the encoding of input_length bytes, 0 on potential integer overflow
+size_t base64_encoded_length(size_t input_length);
+
 // assumptions:
 //	input: data to be encoded is not empty
 //	input_length: length of the data to be encoded
 // output: string containing encoded data or empty string on failure
 std::string base64_encode(const unsigned char* input, size_t input_length);
+
+// assumptions:
+//	input: data to be encoded
+//	input_length: length of the data to be encoded
+//	output: buffer reused between calls, its capacity is kept
+// output: output holds the encoded data, returns its length or 0 on failure
+size_t base64_encode(const unsigned char* input, size_t input_length, std::string& output);
+
+// assumptions:
+//	input: data to be encoded
+//	input_length: length of the data to be encoded
+//	output: caller owned buffer of at least base64_encoded_length(input_length) bytes
+// output: encoded data written to output, returns the number of bytes written
+size_t base64_encode(const unsigned char* input, size_t input_length, char* output);
+
+// assumptions:
+//	input: base64 encoded data with padding, as written by base64_encode
+//	input_length: length of the encoded data
+// output: output holds the decoded data, returns false when input is not valid base64
+bool base64_decode(const char* input, size_t input_length, std::vector<unsigned char>& output);
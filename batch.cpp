@@ -0,0 +1,368 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// custom
+#include "base64.h"
+#include "batch.h"
+#include "bounded_queue.h"
+#include "grabcut.h"
+#include "manifest.h"
+#include "label_store.h"
+#include "pipeline.h"
+#include "segments.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+const filesystem::path BATCH_OUTPUT_PATH("output");
+const filesystem::path BATCH_SEGMENT_PATH("segments");
+const set<string> IMAGE_EXTENSIONS = { ".bmp", ".jpeg", ".jpg", ".png", ".tif", ".tiff", ".webp" };
+
+// assumptions: input: directory searched recursively for images, or a manifest file with one image path per line,
+//	blank lines and lines starting with # are skipped
+// outcome: returns the image paths of input in a stable order, empty when input is missing
+vector<filesystem::path> batch_images(const filesystem::path& input)
+{
+	vector<filesystem::path> paths;
+
+	if (filesystem::is_directory(input))
+	{
+		for (const auto& entry: filesystem::recursive_directory_iterator(input))
+		{
+			string extension = entry.path().extension().string();
+			transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+
+			if (entry.is_regular_file() && IMAGE_EXTENSIONS.count(extension)) paths.push_back(entry.path());
+		}
+		sort(paths.begin(), paths.end());
+	}
+	else
+	{
+		ifstream manifest(input);
+		string line;
+
+		while (getline(manifest, line))
+		{
+			line.erase(line.find_last_not_of(" \t\r") + 1);
+			if (!line.empty() && line[0] != '#') paths.emplace_back(line);
+		}
+	}
+
+	return paths;
+}
+
+// assumptions:
+//	bytes: contents of the image file
+//	name: unique name of the image, used for its segment and output directories
+//	cluster_size: integer values: [2-20]
+//	options: kmeans engine, sweep, tiles, grabcut windows and upload settings
+//	sink: writes the segments, nullptr keeps them off disk
+// outcome: returns the base64 uploads of the image and of all of its kmeans and grabcut segments
+//	and the segment files the sink writes, throws when the image cannot be decoded or a segment cannot be encoded
+ImageWork process_image(const vector<uchar>& bytes, const string& name, int cluster_size, const Options& options,
+	OutputSink* sink)
+{
+	ImageWork work;
+	work.name = name;
+	work.segmented = sink != nullptr;
+
+	Mat img = imdecode(bytes, IMREAD_COLOR);
+	if (img.empty()) throw runtime_error("read failure");
+
+	vector<Segment> segments;
+	Mat labels, centers;
+
+	// sweeps and tiled runs encode every output as soon as it is built, so a sweep only holds one cluster size
+	// and a tiled run reuses its buffer for the next output
+	auto emit = [&](const Segment& segment)
+	{
+		string encoding = encode_segment(segment, sink, options);
+		if (encoding.empty()) throw runtime_error("conversion failure:" + segment.name);
+
+		work.segments.push_back(move(encoding));
+		work.names.push_back(segment.name);
+		if (sink) work.outputs.push_back(segment_path(segment, sink->extension()));
+	};
+
+	if (options.sweep_first > 0) segmentation_sweep(img, name, options.sweep_first, options.sweep_last, options, emit);
+	else if (options.tile_rows > 0)
+		segmentation_tiled(img, name, cluster_size, options, [&](const Segment& segment)
+		{
+			// a sink encoding its own codec keeps the image, which must not be the reused buffer
+			const bool shared = sink_keeps_image(sink, options);
+			emit(shared ? Segment{ segment.directory, segment.name, segment.image.clone() } : segment);
+		});
+	else if (options.grabcut == GrabCutMode::SEEDED) segmentation(img, name, cluster_size, options, segments, &labels, &centers);
+	else segmentation(img, name, cluster_size, options, segments);
+
+	// seeded windows share the cluster statistics, sweeps and tiles keep no labels and cut cold
+	optional<ClusterStats> stats;
+	if (!labels.empty()) stats = cluster_stats(img, labels, centers);
+
+	// the pool is already busy with other images, so this image's windows run one after another
+	for (const auto& window: window_layout(img.size(), options.windows))
+		segments.push_back({ name, format("%s_gc_%s", name.c_str(), window.name.c_str()),
+			grabcut_window(img, window.rectangle, options, stats ? &*stats : nullptr) });
+
+	for (const auto& segment: segments) emit(segment);
+
+	work.base = prepare_base_upload(img, options);
+	if (work.base.empty()) throw runtime_error("conversion failure");
+
+	return work;
+}
+
+// assumptions:
+//	bytes: contents of the image file
+//	name: unique name of the image
+//	outputs: segment files of the image written by an earlier run
+//	options: upload settings, see prepare_upload
+// outcome: returns the base64 uploads of the image and of the segment files, the files are sent as they are on disk
+//	when no upload preparation is set, throws when any of them cannot be read
+ImageWork load_image(const vector<uchar>& bytes, const string& name, const vector<string>& outputs, const Options& options)
+{
+	ImageWork work;
+	work.name = name;
+	work.outputs = outputs;
+
+	Mat img = imdecode(bytes, IMREAD_COLOR);
+	if (img.empty()) throw runtime_error("read failure");
+	if ((work.base = prepare_base_upload(img, options)).empty()) throw runtime_error("conversion failure");
+
+	vector<uchar> buffer;
+	uint64_t hash;
+	for (const auto& output: outputs)
+	{
+		if (!file_hash(output, hash, &buffer)) throw runtime_error("segment read failure");
+
+		Mat segment;
+		if (upload_prepared(options) && (segment = imdecode(buffer, IMREAD_COLOR)).empty()) throw runtime_error("segment read failure");
+		work.segments.push_back(segment.empty() ? base64_encode(buffer.data(), buffer.size()) : prepare_upload(segment, options));
+		work.names.push_back(filesystem::path(output).stem().string());
+	}
+
+	return work;
+}
+
+// assumptions:
+//	works: encoded images, emptied on return
+//	api_key, options, cache: see label_encodings
+//	sink: writes the label files
+//	index: label index or nullptr
+//	manifest: records the finished stages of every image, nullptr records nothing
+//	segment_parameters, label_parameters: settings the stages are recorded with
+// outcome: base and segment labels of every image saved by save_labels, once they are on disk
+//	the segments of every image and the labels of every image labeled in full are recorded as complete,
+//	returns the names of the images whose base or any segment was left without labels
+set<string> label_works(vector<ImageWork>& works, const string& api_key, const Options& options, LabelCache* cache,
+	OutputSink& sink, LabelIndex* index, StageManifest* manifest, const string& segment_parameters, const string& label_parameters)
+{
+	vector<string> base_encodings, base_owners, base_names, segment_encodings, segment_owners, segment_names;
+	vector<ImageWork> records;
+
+	for (auto& work: works)
+	{
+		base_encodings.push_back(move(work.base));
+		base_owners.push_back(work.name);
+		base_names.push_back(work.name);
+
+		for (size_t i = 0; i < work.segments.size(); i++)
+		{
+			segment_encodings.push_back(move(work.segments[i]));
+			segment_owners.push_back(work.name);
+			segment_names.push_back(work.names[i]);
+		}
+		work.segments.clear();
+		if (manifest) records.push_back(move(work));
+	}
+	works.clear();
+
+	LabelStore directory_labels;
+	vector<string> failed;
+
+	label_encodings(base_encodings, base_owners, base_names, api_key, directory_labels, options, cache, &failed);
+	save_labels(BATCH_OUTPUT_PATH, directory_labels, "base_labels", options, &sink, index);
+	directory_labels.clear();
+
+	label_encodings(segment_encodings, segment_owners, segment_names, api_key, directory_labels, options, cache, &failed);
+	save_labels(BATCH_OUTPUT_PATH, directory_labels, "segment_labels", options, &sink, index);
+
+	const set<string> unlabeled(failed.begin(), failed.end());
+	if (!manifest) return unlabeled;
+
+	// stages are only recorded once everything they wrote is on disk, an image missing labels is requested again
+	sink.flush();
+	for (const auto& record: records)
+	{
+		if (record.segmented) manifest->record(record.name, "segments", record.input, segment_parameters, record.outputs);
+		if (!unlabeled.count(record.name))
+			manifest->record(record.name, "labels", record.input, label_parameters, label_files(BATCH_OUTPUT_PATH, record.name, options));
+	}
+
+	return unlabeled;
+}
+
+// assumptions:
+//	input: directory or manifest, see batch_images
+//	cluster_size: integer values: [2-20]
+//	api_key: valid gcp vision api key
+//	options: pipeline settings, batch_threads and batch_queue size the scheduler
+//	cache: label cache or nullptr
+//	sink: writes segments and label files in the background, flushed before returning
+//	index: label index the labels are appended to, or nullptr
+//	manifest: stages completed by earlier runs, nullptr runs every stage of every image
+// outcome:
+//	every image is segmented, cut and encoded on a work-stealing pool while the labeling stage
+//		consumes finished images through a bounded queue, so encoded images never pile up in memory
+//	segments written under the segments directory, base and segment labels appended to the label index
+//		and with json labels written under the output directory, all keyed by the file name of the image
+//	images whose labels are complete for the same file and settings are skipped, images whose segments are
+//		complete are labeled from the segment files, so an interrupted batch resumes where it stopped
+//	a failing image is reported and skipped, returns the number of failed images
+size_t run_batch(const filesystem::path& input, int cluster_size, const string& api_key, const Options& options,
+	LabelCache* cache, OutputSink& sink, LabelIndex* index, StageManifest* manifest)
+{
+	const vector<filesystem::path> paths = batch_images(input);
+	if (paths.empty())
+	{
+		printf("batch input failure:%s\n", input.string().c_str());
+		return 0;
+	}
+
+	filesystem::create_directories(BATCH_OUTPUT_PATH);
+
+	// images sharing a file name get a numbered suffix so their outputs never overwrite each other
+	vector<string> names;
+	map<string, size_t> seen;
+	for (const auto& path: paths)
+	{
+		const string stem = path.stem().string();
+		const size_t count = seen[stem]++;
+		names.push_back(count == 0 ? stem : format("%s_%zu", stem.c_str(), count));
+	}
+
+	const string segment_parameters = segmentation_parameters(cluster_size, options);
+	const string label_parameters = ::label_parameters(cluster_size, options);
+	atomic<size_t> skipped{ 0 };
+
+	ThreadPool pool(options.batch_threads);
+	BoundedQueue<ImageWork> finished(options.batch_queue > 0 ? options.batch_queue : 2 * pool.size());
+
+	mutex failures_mutex;
+	vector<pair<string, string>> failures;
+	auto fail = [&](const string& name, const string& reason)
+	{
+		lock_guard<mutex> lock(failures_mutex);
+		failures.push_back({ name, reason });
+		printf("image failure:%s:%s\n", name.c_str(), reason.c_str());
+	};
+
+	// workers block on a full queue, which holds the cpu stage back while labeling catches up
+	vector<future<void>> pending;
+	for (size_t i = 0; i < paths.size(); i++)
+		pending.push_back(pool.submit([&, i]()
+		{
+			try
+			{
+				vector<uchar> bytes;
+				uint64_t hash = 0;
+				if (!file_hash(paths[i].string(), hash, &bytes)) throw runtime_error("read failure");
+
+				if (manifest && manifest->complete(names[i], "labels", hash, label_parameters))
+				{
+					skipped++;
+					return;
+				}
+
+				// segments on disk from an interrupted run are labeled as they are
+				ImageWork work = manifest && options.write_segments && manifest->complete(names[i], "segments", hash, segment_parameters)
+					? load_image(bytes, names[i], manifest->outputs(names[i], "segments"), options)
+					: process_image(bytes, names[i], cluster_size, options, options.write_segments ? &sink : nullptr);
+				work.input = hash;
+				finished.push(move(work));
+			}
+			catch (const exception& e) { fail(names[i], e.what()); }
+		}));
+
+	// the queue is closed once every image is done so the labeling loop below can drain and stop
+	thread closer([&]()
+	{
+		for (auto& image: pending) image.wait();
+		finished.close();
+	});
+
+	// labeling collects enough images to keep the request window full before sending anything
+	const size_t images_per_round = max<size_t>(options.batch_images, 1) * max<size_t>(options.request_window, 1);
+	vector<ImageWork> works;
+	ImageWork work;
+	size_t labeled = 0;
+
+	// a failing labeling round closes the queue first, so workers blocked on it drop their images and the closer
+	// can be joined before the failure leaves run_batch
+	try
+	{
+		while (finished.pop(work))
+		{
+			size_t images = 0;
+
+			do
+			{
+				images += work.segments.size() + 1;
+				works.push_back(move(work));
+			} while (images < images_per_round && finished.try_pop(work));
+
+			// images left without labels count as failed, not labeled
+			labeled += works.size();
+			for (const auto& name: label_works(works, api_key, options, cache, sink, index, manifest, segment_parameters, label_parameters))
+			{
+				labeled--;
+				fail(name, "labeling");
+			}
+			printf("batch progress:%zu/%zu\n", labeled + skipped, paths.size());
+		}
+	}
+	catch (...)
+	{
+		finished.close();
+		closer.join();
+		throw;
+	}
+	closer.join();
+	sink.flush();
+
+	printf("batch: %zu images, %zu labeled, %zu up to date, %zu failed\n", paths.size(), labeled, skipped.load(), failures.size());
+
+	if (!failures.empty())
+	{
+		ofstream report(BATCH_OUTPUT_PATH / "batch_failures.txt");
+		for (const auto& [name, reason]: failures) report << name << '\t' << reason << '\n';
+	}
+
+	return failures.size();
+}
@@ -0,0 +1,70 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// custom
+#include "label_cache.h"
+#include "label_index.h"
+#include "manifest.h"
+#include "options.h"
+#include "output_sink.h"
+
+// encoded output of one image handed from the cpu stage to the labeling stage
+struct ImageWork
+{
+	std::string name;
+	std::string base;
+
+	// base64 encoding and name of every segment
+	std::vector<std::string> segments;
+	std::vector<std::string> names;
+
+	// hash of the image file and the segment files, segmented when they were written by this run
+	uint64_t input = 0;
+	std::vector<std::string> outputs;
+	bool segmented = false;
+};
+
+// assumptions:
+//	bytes: contents of the image file
+//	name: unique name of the image, used for its segment and output directories
+//	cluster_size: integer values: [2-20]
+//	options: kmeans engine, sweep, tiles and grabcut windows
+//	sink: writes the segments, nullptr keeps them off disk
+// outcome: returns the base64 jpegs of the image and of all of its kmeans and grabcut segments
+//	and the segment files the sink writes, throws when the image cannot be decoded or a segment cannot be encoded
+ImageWork process_image(const std::vector<unsigned char>& bytes, const std::string& name, int cluster_size,
+	const Options& options, OutputSink* sink);
+
+// assumptions: input: directory searched recursively for images, or a manifest file with one image path per line,
+//	blank lines and lines starting with # are skipped
+// outcome: returns the image paths of input in a stable order, empty when input is missing
+std::vector<std::filesystem::path> batch_images(const std::filesystem::path& input);
+
+// assumptions:
+//	input: directory or manifest, see batch_images
+//	cluster_size: integer values: [2-20]
+//	api_key: valid gcp vision api key
+//	options: pipeline settings, batch_threads and batch_queue size the scheduler
+//	cache: label cache or nullptr
+//	sink: writes segments and label files in the background, flushed before returning
+//	index: label index the labels are appended to, or nullptr
+//	manifest: stages completed by earlier runs, nullptr runs every stage of every image
+// outcome:
+//	every image is segmented, cut and encoded on a work-stealing pool while the labeling stage
+//		consumes finished images through a bounded queue, so encoded images never pile up in memory
+//	segments written under the segments directory, base and segment labels appended to the label index
+//		and with json labels written under the output directory, all keyed by the file name of the image
+//	images whose labels are complete for the same file and settings are skipped, images whose segments are
+//		complete are labeled from the segment files, so an interrupted batch resumes where it stopped
+//	a failing image is reported and skipped, returns the number of failed images
+size_t run_batch(const std::filesystem::path& input, int cluster_size, const std::string& api_key, const Options& options,
+	LabelCache* cache, OutputSink& sink, LabelIndex* index, StageManifest* manifest);
@@ -0,0 +1,363 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// benchmark of every pipeline stage, fully offline: images come from the images directory and
+// from a synthetic generator, annotate requests go to the local mock endpoint
+//	usage: benchmark.exe [--repetitions=<n>] [--filter=<substring>] [--report=<path>] [--name=value ...]
+//	the remaining --name=value settings are the ones of segmentation-context, see parse_options
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// vcpkg
+#include <cpprest/json.h>
+
+// custom
+#include "base64.h"
+#include "grabcut.h"
+#include "label_index.h"
+#include "label_store.h"
+#include "mock_vision.h"
+#include "options.h"
+#include "pipeline.h"
+#include "segments.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+using namespace web;
+
+// global constants
+const filesystem::path INPUT_PATH("images");
+const filesystem::path BENCHMARK_PATH("output/benchmark");
+const vector<Size> SYNTHETIC_SIZES = { Size(320, 240), Size(640, 480), Size(1280, 960) };
+const vector<int> CLUSTER_SIZES = { 2, 4, 8, 12, 16, 20 };
+const int SEEDED_CLUSTERS = 8;
+const vector<size_t> IMAGE_COUNTS = { 1, 16, 64 };
+const size_t LABELS_PER_IMAGE = 50;
+
+// one parameterized measurement, bytes is the input size of a single run or 0 when throughput means nothing
+struct Case
+{
+	string stage;
+	string parameters;
+	size_t bytes;
+	function<void()> run;
+};
+
+// outcome: returns a deterministic image of size made of flat color regions with gaussian noise,
+//	so every run clusters the same data
+Mat synthetic_image(const Size& size)
+{
+	const Vec3b COLORS[] = { { 40, 60, 200 }, { 30, 160, 60 }, { 200, 120, 40 }, { 220, 220, 220 }, { 20, 20, 20 }, { 150, 40, 160 } };
+
+	Mat image(size, CV_8UC3), noise(size, CV_16SC3);
+	for (int y = 0; y < size.height; y++)
+		for (int x = 0; x < size.width; x++)
+			image.at<Vec3b>(y, x) = COLORS[(y * 2 / size.height) * 3 + x * 3 / size.width];
+
+	RNG rng(0x5eed);
+	rng.fill(noise, RNG::NORMAL, 0, 12);
+	add(image, noise, image, noArray(), CV_8UC3);
+
+	return image;
+}
+
+// outcome: returns the jpeg bytes of image
+vector<uchar> jpeg(const Mat& image)
+{
+	vector<uchar> buffer;
+	imencode(".jpg", image, buffer);
+	return buffer;
+}
+
+// outcome: returns a utf-8 annotate response body with labels for images images
+string synthetic_response(size_t images)
+{
+	json::value body = json::value::object();
+	body[L"responses"] = json::value::array();
+
+	for (size_t i = 0; i < images; i++)
+	{
+		json::value response = json::value::object();
+		response[L"labelAnnotations"] = json::value::array();
+
+		for (size_t j = 0; j < LABELS_PER_IMAGE; j++)
+		{
+			json::value annotation = json::value::object();
+			annotation[L"description"] = json::value(to_wstring(format("label%zu", (i * 7 + j) % 500)));
+			annotation[L"score"] = json::value(0.5 + 0.01 * static_cast<double>(j % 50));
+			annotation[L"topicality"] = json::value(0.5);
+			response[L"labelAnnotations"][j] = annotation;
+		}
+		body[L"responses"][i] = response;
+	}
+
+	return to_string(body.serialize());
+}
+
+// assumptions:
+//	options: settings of the measured stages
+//	images: named input images
+//	cases: properly initialized vector
+//	check_failures: counts runs whose results are wrong, must outlive the cases
+// outcome: every stage benchmark appended to cases, the captured inputs are prepared once up front
+void build_cases(const Options& options, const vector<pair<string, Mat>>& images, const string& api_key, vector<Case>& cases,
+	size_t& check_failures)
+{
+	for (const auto& named: images)
+	{
+		const string name = named.first;
+		const Mat image = named.second;
+		const string size = format("%s %dx%d", name.c_str(), image.cols, image.rows);
+		const size_t pixels = image.total() * image.elemSize();
+
+		for (int clusters: CLUSTER_SIZES)
+			cases.push_back({ "segmentation", format("%s k=%d", size.c_str(), clusters), pixels, [=, &options]()
+			{
+				Mat input = image;
+				vector<Segment> segments;
+				segmentation(input, name, clusters, options, segments);
+			}});
+
+		// the slic engine on the same cluster sizes, the superpixels are computed again for every run
+		auto slic = make_shared<Options>(options);
+		slic->engine = KMeansEngine::SLIC;
+		for (int clusters: CLUSTER_SIZES)
+			cases.push_back({ "segmentation_slic", format("%s k=%d n=%d", size.c_str(), clusters, slic->slic_superpixels), pixels, [=]()
+			{
+				Mat input = image;
+				vector<Segment> segments;
+				segmentation(input, name, clusters, *slic, segments);
+			}});
+
+		for (const auto& window: window_layout(image.size(), options.windows))
+			cases.push_back({ "grabcut", format("%s %s", size.c_str(), window.name.c_str()),
+				static_cast<size_t>(window.rectangle.area()) * image.elemSize(), [=]() { _grabCut(image, window.rectangle); } });
+
+		// seeded windows start from the labels of one segmentation run, the statistics are shared by every window
+		// of an image like in the pipeline, so gathering them is measured once
+		auto labels = make_shared<Mat>(), centers = make_shared<Mat>();
+		vector<Segment> segments;
+		{
+			Mat input = image;
+			segmentation(input, name, SEEDED_CLUSTERS, options, segments, labels.get(), centers.get());
+		}
+		auto stats = make_shared<ClusterStats>();
+		cases.push_back({ "cluster_stats", format("%s k=%d", size.c_str(), centers->rows), pixels, [=]()
+		{
+			*stats = cluster_stats(image, *labels, *centers);
+		}});
+		*stats = cluster_stats(image, *labels, *centers);
+
+		for (const auto& window: window_layout(image.size(), options.windows))
+			cases.push_back({ "grabcut_seeded", format("%s %s", size.c_str(), window.name.c_str()),
+				static_cast<size_t>(window.rectangle.area()) * image.elemSize(), [=]() { grabcut_seeded(image, window.rectangle, *stats); } });
+
+		for (const auto& window: window_layout(image.size(), options.windows))
+			cases.push_back({ "grabcut_pyramid", format("%s %s edge=%d", size.c_str(), window.name.c_str(), options.grabcut_edge),
+				static_cast<size_t>(window.rectangle.area()) * image.elemSize(), [=, &options]()
+				{
+					grabcut_pyramid(image, window.rectangle, options.grabcut_edge);
+				}});
+
+		// uploads of the whole image and of its first kmeans segment, mostly black like every segment
+		cases.push_back({ "prepare_base_upload", format("%s base=%d", size.c_str(), options.upload_base ? 1 : 0),
+			pixels, [=, &options]() { prepare_base_upload(image, options); } });
+		if (!segments.empty())
+		{
+			const Mat segment = segments.front().image;
+			cases.push_back({ "prepare_upload", format("%s segment edge=%d bytes=%zu", size.c_str(), options.upload_edge,
+				options.upload_bytes), pixels, [=, &options]() { prepare_upload(segment, options); } });
+		}
+
+		auto bytes = make_shared<vector<uchar>>(jpeg(image));
+		auto output = make_shared<string>();
+		cases.push_back({ "base64_encode", size, bytes->size(), [=]() { base64_encode(bytes->data(), bytes->size(), *output); } });
+	}
+
+	if (images.empty()) return;
+
+	// request building and parsing are measured on the jpeg of the first image repeated
+	const string encoding = [&]() { vector<uchar> bytes = jpeg(images.front().second); return base64_encode(bytes.data(), bytes.size()); }();
+
+	for (size_t count: IMAGE_COUNTS)
+	{
+		auto encodings = make_shared<vector<string>>(count, encoding);
+		auto body = make_shared<string>();
+		cases.push_back({ "generate_json", format("images=%zu", count), count * encoding.size(), [=, &options]()
+		{
+			vector<size_t> batch_starts;
+			batch_requests(*encodings, batch_starts, options);
+			for (size_t batch = 0; batch < batch_starts.size(); batch++)
+				generate_json(*encodings, batch_starts[batch], batch + 1 < batch_starts.size() ? batch_starts[batch + 1] : count, *body);
+		}});
+
+		auto response = make_shared<string>(synthetic_response(count));
+		auto store = make_shared<LabelStore>();
+		cases.push_back({ "parse_responses", format("images=%zu labels=%zu", count, LABELS_PER_IMAGE), response->size(), [=]()
+		{
+			vector<ImageLabels> image_labels(count);
+			parse_responses(*response, 0, count, image_labels, *store);
+		}});
+
+		// full round trip against the mock endpoint, including building the bodies, injected faults must be
+		// retried until every image has its labels
+		auto batch_starts = make_shared<vector<size_t>>();
+		batch_requests(*encodings, *batch_starts, options);
+		cases.push_back({ "make_requests", format("images=%zu window=%zu", count, options.request_window), count * encoding.size(), [=, &options, &check_failures]()
+		{
+			vector<ImageLabels> image_labels(count);
+			const size_t failures = make_requests(*encodings, *batch_starts, api_key, image_labels, options, *store);
+			const size_t unlabeled = count_if(image_labels.begin(), image_labels.end(), [](const ImageLabels& labels) { return !labels; });
+
+			if (failures > 0 || unlabeled > 0)
+			{
+				printf("make_requests check failure: %zu requests given up on, %zu images without labels\n", failures, unlabeled);
+				check_failures++;
+			}
+		}});
+
+		auto directory_labels = make_shared<LabelStore>();
+		for (size_t directory = 0; directory < count; directory++)
+		{
+			vector<ScoredLabel> labels;
+			for (size_t label = 0; label < LABELS_PER_IMAGE; label++)
+				labels.push_back({ directory_labels->intern(format("label%zu", label)), 0.5f + 0.01f * label, 0.5f });
+			directory_labels->merge(format("directory%zu", directory), format("image%zu", directory), labels);
+		}
+		cases.push_back({ "write_json", format("directories=%zu labels=%zu", count, LABELS_PER_IMAGE), 0, [=]()
+		{
+			write_json(BENCHMARK_PATH, *directory_labels, "benchmark_labels");
+		}});
+
+		// appends replace the same images, so the index settles at one chunk per append since the last compaction
+		auto index = make_shared<LabelIndex>((BENCHMARK_PATH / format("benchmark%zu.index", count)).string());
+		cases.push_back({ "label_index_append", format("directories=%zu labels=%zu", count, LABELS_PER_IMAGE), 0, [=]()
+		{
+			index->append(*directory_labels, "benchmark_labels");
+		}});
+		cases.push_back({ "label_index_query", format("directories=%zu labels=%zu", count, LABELS_PER_IMAGE), 0, [=]()
+		{
+			index->find("label1");
+			index->labels("directory0");
+		}});
+	}
+}
+
+// assumptions:
+//	argv[1...]: optional --name=value settings
+// outcome: every benchmark case matching the filter timed, printed as a table and written as json to the report path
+int main(int argc, char** argv)
+{
+	int repetitions = 5;
+	string filter, report = (BENCHMARK_PATH / "benchmark.json").string();
+	vector<char*> forwarded = { argv[0] };
+
+	// benchmark settings are consumed here, everything else configures the stages
+	for (int i = 1; i < argc; i++)
+	{
+		const string argument(argv[i]);
+		const size_t split = argument.find('=');
+		const string name = argument.substr(0, split);
+		const string value = split == string::npos ? string() : argument.substr(split + 1);
+
+		if (name == "--repetitions") repetitions = max(atoi(value.c_str()), 1);
+		else if (name == "--filter") filter = value;
+		else if (name == "--report") report = value;
+		else forwarded.push_back(argv[i]);
+	}
+
+	Options options;
+	parse_options(static_cast<int>(forwarded.size()), forwarded.data(), 1, options);
+	if (!options.trace.empty()) trace_enable();
+
+	// requests never leave the machine
+	options.endpoint = format("http://localhost:%d/", options.mock_port);
+	MockVisionServer mock(to_wstring(options.endpoint), chrono::milliseconds(options.mock_latency), options.mock_fault_rate);
+
+	filesystem::create_directories(BENCHMARK_PATH);
+
+	vector<pair<string, Mat>> images;
+	for (const auto& size: SYNTHETIC_SIZES) images.push_back({ "synthetic", synthetic_image(size) });
+	if (filesystem::exists(INPUT_PATH))
+		for (const auto& entry: filesystem::recursive_directory_iterator(INPUT_PATH))
+		{
+			if (!entry.is_regular_file()) continue;
+
+			Mat image = imread(entry.path().string());
+			if (!image.empty()) images.push_back({ entry.path().stem().string(), image });
+			else printf("read failure:%s\n", entry.path().string().c_str());
+		}
+
+	vector<Case> cases;
+	size_t check_failures = 0;
+	build_cases(options, images, "mock", cases, check_failures);
+
+	json::value results = json::value::array();
+	size_t index = 0;
+
+	printf("%-16s %-36s %10s %10s %10s %10s\n", "stage", "parameters", "min ms", "median ms", "mean ms", "MB/s");
+
+	for (const auto& test: cases)
+	{
+		if (!filter.empty() && (test.stage + " " + test.parameters).find(filter) == string::npos) continue;
+
+		// one untimed run warms caches, pools and lazily created buffers
+		test.run();
+
+		vector<double> times;
+		for (int repetition = 0; repetition < repetitions; repetition++)
+		{
+			const auto start = chrono::steady_clock::now();
+			test.run();
+			times.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+		}
+
+		sort(times.begin(), times.end());
+		double mean = 0;
+		for (double time: times) mean += time / times.size();
+		const double median = times[times.size() / 2];
+		const double throughput = test.bytes > 0 && median > 0 ? test.bytes / (median * 1e3) : 0;
+
+		printf("%-16s %-36s %10.3f %10.3f %10.3f %10.1f\n", test.stage.c_str(), test.parameters.c_str(),
+			times.front(), median, mean, throughput);
+
+		json::value result = json::value::object();
+		result[L"stage"] = json::value(to_wstring(test.stage));
+		result[L"parameters"] = json::value(to_wstring(test.parameters));
+		result[L"repetitions"] = json::value(repetitions);
+		result[L"bytes"] = json::value(static_cast<double>(test.bytes));
+		result[L"min_ms"] = json::value(times.front());
+		result[L"median_ms"] = json::value(median);
+		result[L"mean_ms"] = json::value(mean);
+		result[L"max_ms"] = json::value(times.back());
+		result[L"megabytes_per_second"] = json::value(throughput);
+		results[index++] = result;
+	}
+
+	ofstream report_file(report);
+	report_file << to_string(results.serialize());
+	if (!report_file) printf("write failure:%s\n", report.c_str());
+
+	printf("mock requests served:%zu faults:%zu\n", mock.served(), mock.faults());
+	if (trace_enabled() && trace_export(options.trace)) trace_summary();
+
+	if (check_failures > 0) printf("check failures:%zu\n", check_failures);
+	return check_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,86 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// fixed capacity queue between pipeline stages, producers block while it is full so a fast
+// stage never runs ahead of a slow one by more than capacity items
+template <typename T>
+class BoundedQueue
+{
+public:
+	// assumptions: capacity: items held before push blocks, at least 1
+	explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// outcome: item queued once there is room, returns false and drops it when the queue is closed
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return closed || items.size() < capacity; });
+
+		if (closed) return false;
+
+		items.push_back(std::move(item));
+		lock.unlock();
+		not_empty.notify_one();
+
+		return true;
+	}
+
+	// outcome: returns true and the oldest item once there is one, false when closed and drained
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+
+		return take(item, lock);
+	}
+
+	// outcome: returns true and the oldest item when one is queued, never blocks
+	bool try_pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		return take(item, lock);
+	}
+
+	// outcome: blocked producers and consumers are released, queued items can still be popped
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		not_full.notify_all();
+		not_empty.notify_all();
+	}
+
+private:
+	bool take(T& item, std::unique_lock<std::mutex>& lock)
+	{
+		if (items.empty()) return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		lock.unlock();
+		not_full.notify_one();
+
+		return true;
+	}
+
+	const size_t capacity;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+	bool closed = false;
+};
@@ -0,0 +1,429 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cstdlib>
+#include <future>
+#include <optional>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// custom
+#include "grabcut.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+const int WINDOW_MARGIN = 10;
+const double CENTER_FRACTION = 0.75;
+
+// context kept around a window by the pyramid cut, at least ROI_MARGIN pixels or a tenth of its longer side,
+// and the extra full resolution pixels refined on each side of the coarse edge
+const int ROI_MARGIN = 16;
+const int BAND_PIXELS = 2;
+
+// gaussians per color model of cv::grabCut, its model layout is the weights, then the means, then the covariances,
+// and the variance added to seeded covariances so flat clusters stay invertible
+const int GMM_COMPONENTS = 5;
+const double VARIANCE_FLOOR = 1.0;
+
+// assumptions:
+//	img: valid image matrix in opencv
+//	rectangle: rectangle are smaller than img window 
+// outcome: outputing image with grabcuts segments  
+Mat _grabCut(const Mat& img, Rect rectangle) {
+	TraceScope trace("grabcut", img.total() * img.elemSize());
+
+	//initializing the matrix for grabcut
+	Mat results;
+	Mat background_m, foreground_m;
+
+	//grab cut
+	grabCut(img, results, rectangle, background_m, foreground_m, 1, GC_INIT_WITH_RECT);
+	compare(results, GC_PR_FGD, results, CMP_EQ);
+
+	//making the foreground objects 
+	Mat foreground(img.size(), CV_8UC3, Scalar(0, 0, 0));
+	img.copyTo(foreground, results);
+	trace.bytes_out(foreground.total() * foreground.elemSize());
+
+	return foreground;
+}
+
+// assumptions:
+//	img: CV_8UC3 image
+//	rectangle: window inside img, at least 2 x 2 pixels
+//	coarse_edge: longer side of the coarse level in pixels
+// outcome: returns the foreground of rectangle cropped to its bounding box, black elsewhere in the box,
+//	cut on the window and a margin around it, solved at coarse_edge pixels first and refined at full resolution
+//	only on the bounding box of the band around the coarse edge, starting from the coarse color models,
+//	a window too thin for the coarse level is cut at full resolution, a black image of the rectangle when
+//	nothing is foreground
+Mat grabcut_pyramid(const Mat& img, Rect rectangle, int coarse_edge)
+{
+	TraceScope trace("grabcut_pyramid", static_cast<uint64_t>(rectangle.area()) * img.elemSize());
+
+	// grabcut only models the rectangle and its surroundings, so everything further away is left out
+	const int margin = max(ROI_MARGIN, max(rectangle.width, rectangle.height) / 10);
+	const Rect roi = Rect(rectangle.x - margin, rectangle.y - margin, rectangle.width + 2 * margin, rectangle.height + 2 * margin)
+		& Rect(0, 0, img.cols, img.rows);
+	const Mat region = img(roi);
+
+	// grabcut needs background samples, so a window covering the whole region keeps a one pixel border
+	const Rect inner = (rectangle - roi.tl()) & Rect(1, 1, max(roi.width - 2, 0), max(roi.height - 2, 0));
+	if (inner.width < 2 || inner.height < 2) return Mat(rectangle.size(), img.type(), Scalar::all(0));
+
+	Mat mask, background_m, foreground_m, small;
+	double scale = min(1.0, static_cast<double>(max(coarse_edge, 1)) / max(roi.width, roi.height));
+	Rect small_inner;
+
+	if (scale < 1)
+	{
+		resize(region, small, Size(), scale, scale, INTER_AREA);
+		// margins that scale down to nothing still leave a one pixel background border, a coarse level too thin
+		// for a window inside that border is skipped and the region is cut at full resolution
+		small_inner = Rect(cvFloor(inner.x * scale), cvFloor(inner.y * scale), max(cvRound(inner.width * scale), 2),
+			max(cvRound(inner.height * scale), 2)) & Rect(1, 1, max(small.cols - 2, 0), max(small.rows - 2, 0));
+		if (small_inner.width < 2 || small_inner.height < 2) scale = 1;
+	}
+
+	if (scale < 1)
+	{
+		// coarse cut of the downscaled region
+		Mat coarse;
+		grabCut(small, coarse, small_inner, background_m, foreground_m, 1, GC_INIT_WITH_RECT);
+
+		// pixels further than the band from the scaled up coarse edge keep their coarse label as a definite one,
+		// so the full resolution pass only decides the band
+		Mat cut, inside, outside;
+		bitwise_and(coarse, Scalar(1), coarse);
+		resize(coarse, cut, region.size(), 0, 0, INTER_NEAREST);
+
+		const int band = cvCeil(1 / scale) + BAND_PIXELS;
+		const Mat kernel = getStructuringElement(MORPH_RECT, Size(2 * band + 1, 2 * band + 1));
+		erode(cut, inside, kernel);
+		dilate(cut, outside, kernel);
+
+		mask = Mat(region.size(), CV_8U, Scalar(GC_BGD));
+		Mat window = mask(inner);
+		window.setTo(GC_PR_BGD, outside(inner));
+		window.setTo(GC_PR_FGD, cut(inner));
+		window.setTo(GC_FGD, inside(inner));
+
+		// a band without both labels leaves nothing to refine, otherwise only the box around the band plus a band
+		// of definite context is solved, evaluated from the coarse models instead of fitting new ones
+		const int foreground = countNonZero(cut(inner));
+		if (foreground > 0 && foreground < inner.area())
+		{
+			Mat uncertain = Mat::zeros(region.size(), CV_8U);
+			subtract(outside(inner), inside(inner), uncertain(inner));
+
+			const Rect refine = Rect(boundingRect(uncertain) - Point(band, band) + Size(2 * band, 2 * band))
+				& Rect(0, 0, region.cols, region.rows);
+			TraceScope refine_trace("grabcut_refine", static_cast<uint64_t>(refine.area()) * img.elemSize());
+
+			Mat refined = mask(refine);
+			grabCut(region(refine), refined, Rect(), background_m, foreground_m, 1, GC_EVAL);
+		}
+	}
+	else grabCut(region, mask, inner, background_m, foreground_m, 1, GC_INIT_WITH_RECT);
+
+	// definite and probable foreground both have the low bit set
+	bitwise_and(mask, Scalar(1), mask);
+	const Rect box = boundingRect(mask);
+	if (box.area() == 0) return Mat(rectangle.size(), img.type(), Scalar::all(0));
+
+	Mat foreground(box.size(), img.type(), Scalar::all(0));
+	region(box).copyTo(foreground, mask(box));
+	trace.bytes_out(foreground.total() * foreground.elemSize());
+
+	return foreground;
+}
+
+// assumptions:
+//	img: CV_8UC3 image
+//	labels: CV_32S cluster of every pixel of img, one per row or rows x cols
+//	centers: CV_32F clusters x 3 centers in the color space of img
+// outcome: returns the pixel count, center and covariance of every cluster
+ClusterStats cluster_stats(const Mat& img, const Mat& labels, const Mat& centers)
+{
+	TraceScope trace("cluster_stats", img.total() * img.elemSize());
+
+	const int clusters = centers.rows;
+	const int stripes = max(getNumThreads(), 1);
+
+	ClusterStats stats;
+	stats.labels = labels.reshape(1, img.rows);
+	stats.centers.assign(clusters, Vec3d());
+	for (int k = 0; k < clusters; k++)
+		for (int c = 0; c < 3; c++) stats.centers[k][c] = centers.at<float>(k, c);
+
+	// count and upper triangle of the scatter around the center per cluster and stripe
+	vector<vector<double>> partials(stripes, vector<double>(static_cast<size_t>(clusters) * 7, 0));
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		for (int stripe = range.start; stripe < range.end; stripe++)
+		{
+			vector<double>& moments = partials[stripe];
+
+			for (int y = img.rows * stripe / stripes; y < img.rows * (stripe + 1) / stripes; y++)
+			{
+				const Vec3b* pixel = img.ptr<Vec3b>(y);
+				const int* label = stats.labels.ptr<int>(y);
+
+				for (int x = 0; x < img.cols; x++)
+				{
+					const Vec3d& center = stats.centers[label[x]];
+					const double d0 = pixel[x][0] - center[0], d1 = pixel[x][1] - center[1], d2 = pixel[x][2] - center[2];
+					double* moment = moments.data() + static_cast<size_t>(label[x]) * 7;
+
+					moment[0] += 1;
+					moment[1] += d0 * d0;
+					moment[2] += d0 * d1;
+					moment[3] += d0 * d2;
+					moment[4] += d1 * d1;
+					moment[5] += d1 * d2;
+					moment[6] += d2 * d2;
+				}
+			}
+		}
+	});
+
+	stats.counts.assign(clusters, 0);
+	stats.covariances.assign(clusters, Matx33d::eye() * VARIANCE_FLOOR);
+
+	for (int k = 0; k < clusters; k++)
+	{
+		double moment[7] = {};
+		for (const auto& partial: partials)
+			for (int m = 0; m < 7; m++) moment[m] += partial[static_cast<size_t>(k) * 7 + m];
+
+		stats.counts[k] = static_cast<int>(moment[0]);
+		if (moment[0] == 0) continue;
+
+		const double n = moment[0];
+		stats.covariances[k] += Matx33d(moment[1] / n, moment[2] / n, moment[3] / n,
+			moment[2] / n, moment[4] / n, moment[5] / n,
+			moment[3] / n, moment[5] / n, moment[6] / n);
+	}
+
+	return stats;
+}
+
+// outcome: returns a cv::grabCut color model of the heaviest clusters of weights, weighted by them,
+//	empty when no cluster has weight
+static Mat gmm_model(const ClusterStats& stats, const vector<double>& weights)
+{
+	vector<int> order(weights.size());
+	for (size_t k = 0; k < order.size(); k++) order[k] = static_cast<int>(k);
+
+	const size_t components = min<size_t>(GMM_COMPONENTS, order.size());
+	partial_sort(order.begin(), order.begin() + components, order.end(), [&](int a, int b) { return weights[a] > weights[b]; });
+
+	double total = 0;
+	for (size_t i = 0; i < components; i++) total += weights[order[i]];
+	if (total <= 0) return Mat();
+
+	Mat model(1, GMM_COMPONENTS * 13, CV_64F, Scalar(0));
+	double* coefficients = model.ptr<double>();
+	double* means = coefficients + GMM_COMPONENTS;
+	double* covariances = means + 3 * GMM_COMPONENTS;
+
+	for (size_t i = 0; i < components && weights[order[i]] > 0; i++)
+	{
+		const int k = order[i];
+		coefficients[i] = weights[k] / total;
+		for (int c = 0; c < 3; c++) means[i * 3 + c] = stats.centers[k][c];
+		for (int c = 0; c < 9; c++) covariances[i * 9 + c] = stats.covariances[k].val[c];
+	}
+
+	return model;
+}
+
+// assumptions:
+//	img: CV_8UC3 image
+//	rectangle: window inside img
+//	stats: cluster statistics of img
+// outcome: returns the same foreground image as _grabCut, seeded from the clusters instead of a cold rectangle:
+//	clusters denser inside the window than outside it start as probable foreground, the others as probable
+//	background, and both color models start from the cluster statistics, so grabcut skips its own kmeans,
+//	falls back to _grabCut when no cluster seeds one of the models
+Mat grabcut_seeded(const Mat& img, Rect rectangle, const ClusterStats& stats)
+{
+	TraceScope trace("grabcut_seeded", static_cast<uint64_t>(rectangle.area()) * img.elemSize());
+
+	const int clusters = static_cast<int>(stats.counts.size());
+	vector<int> inside(clusters, 0);
+
+	for (int y = rectangle.y; y < rectangle.y + rectangle.height; y++)
+	{
+		const int* label = stats.labels.ptr<int>(y);
+		for (int x = rectangle.x; x < rectangle.x + rectangle.width; x++) inside[label[x]]++;
+	}
+
+	// the background model sees every pixel outside the window and the background clusters inside it,
+	// like grabcut's own samples would
+	const double area_inside = rectangle.area();
+	const double area_outside = static_cast<double>(img.total()) - area_inside;
+	vector<bool> foreground(clusters);
+	vector<double> foreground_weights(clusters, 0), background_weights(clusters, 0);
+
+	for (int k = 0; k < clusters; k++)
+	{
+		const int outside = stats.counts[k] - inside[k];
+		foreground[k] = inside[k] > 0 && (area_outside <= 0 || inside[k] / area_inside > outside / area_outside);
+
+		background_weights[k] = outside + (foreground[k] ? 0 : inside[k]);
+		foreground_weights[k] = foreground[k] ? inside[k] : 0;
+	}
+
+	Mat background_m = gmm_model(stats, background_weights), foreground_m = gmm_model(stats, foreground_weights);
+	if (background_m.empty() || foreground_m.empty()) return _grabCut(img, rectangle);
+
+	Mat results(img.size(), CV_8U, Scalar(GC_BGD));
+	for (int y = rectangle.y; y < rectangle.y + rectangle.height; y++)
+	{
+		const int* label = stats.labels.ptr<int>(y);
+		uchar* mask = results.ptr<uchar>(y);
+		for (int x = rectangle.x; x < rectangle.x + rectangle.width; x++) mask[x] = foreground[label[x]] ? GC_PR_FGD : GC_PR_BGD;
+	}
+
+	// evaluation mode reassigns the pixels to the given gaussians and relearns them, instead of fitting new ones
+	grabCut(img, results, rectangle, background_m, foreground_m, 1, GC_EVAL);
+	compare(results, GC_PR_FGD, results, CMP_EQ);
+
+	Mat output(img.size(), CV_8UC3, Scalar(0, 0, 0));
+	img.copyTo(output, results);
+	trace.bytes_out(output.total() * output.elemSize());
+
+	return output;
+}
+
+// assumptions: stats: cluster statistics of img or nullptr, only used by the seeded mode
+// outcome: returns the foreground of rectangle cut by the grabcut mode of options, the seeded mode without
+//	stats cuts like the full one
+Mat grabcut_window(const Mat& img, Rect rectangle, const Options& options, const ClusterStats* stats)
+{
+	if (options.grabcut == GrabCutMode::PYRAMID) return grabcut_pyramid(img, rectangle, options.grabcut_edge);
+	if (options.grabcut == GrabCutMode::SEEDED && stats) return grabcut_seeded(img, rectangle, *stats);
+	return _grabCut(img, rectangle);
+}
+
+// assumptions:
+//	size: size of the image the windows are placed on
+//	layout: comma separated list of
+//		quadrants: the four image quadrants, named quadrant1 to quadrant4
+//		center[:<fraction>]: centered window covering fraction of each side, 0.75 by default
+//		grid:<rows>x<cols>: rows x cols equal cells, named grid_<row>_<col>
+//		rect:<x>:<y>:<width>:<height>: explicit window, named rect<index>
+// outcome: returns the windows of layout clipped to size, invalid or empty entries are reported and skipped
+vector<GrabCutWindow> window_layout(const Size& size, const string& layout)
+{
+	const Rect bounds(0, 0, size.width, size.height);
+	const int cols = size.width, rows = size.height;
+
+	vector<GrabCutWindow> windows;
+	stringstream entries(layout);
+	string entry;
+	int rect_index = 0;
+
+	while (getline(entries, entry, ','))
+	{
+		const size_t split = entry.find(':');
+		const string kind = entry.substr(0, split);
+		const string value = split == string::npos ? string() : entry.substr(split + 1);
+		vector<GrabCutWindow> added;
+
+		if (kind == "quadrants")
+		{
+			// same windows as the original hardcoded cuts, each inset by the margin on its leading edges
+			added.push_back({ "quadrant1", Rect(WINDOW_MARGIN, WINDOW_MARGIN, cols / 2 - WINDOW_MARGIN, rows / 2 - WINDOW_MARGIN) });
+			added.push_back({ "quadrant2", Rect(cols / 2 + WINDOW_MARGIN, WINDOW_MARGIN, cols / 2 - WINDOW_MARGIN, rows / 2 - WINDOW_MARGIN) });
+			added.push_back({ "quadrant3", Rect(WINDOW_MARGIN, rows / 2 + WINDOW_MARGIN, cols / 2 - WINDOW_MARGIN, rows / 2 - WINDOW_MARGIN) });
+			added.push_back({ "quadrant4", Rect(cols / 2 + WINDOW_MARGIN, rows / 2 + WINDOW_MARGIN, cols / 2 - WINDOW_MARGIN, rows / 2 - WINDOW_MARGIN) });
+		}
+		else if (kind == "center")
+		{
+			const double fraction = value.empty() ? CENTER_FRACTION : atof(value.c_str());
+			added.push_back({ "center", Rect(static_cast<int>(cols * (1 - fraction) / 2), static_cast<int>(rows * (1 - fraction) / 2),
+				static_cast<int>(cols * fraction), static_cast<int>(rows * fraction)) });
+		}
+		else if (kind == "grid")
+		{
+			int grid_rows = 0, grid_cols = 0;
+			sscanf(value.c_str(), "%dx%d", &grid_rows, &grid_cols);
+
+			for (int r = 0; r < grid_rows; r++)
+				for (int c = 0; c < grid_cols; c++)
+				{
+					const int x = cols * c / grid_cols, y = rows * r / grid_rows;
+					added.push_back({ format("grid_%d_%d", r, c), Rect(x + WINDOW_MARGIN, y + WINDOW_MARGIN,
+						cols * (c + 1) / grid_cols - x - WINDOW_MARGIN, rows * (r + 1) / grid_rows - y - WINDOW_MARGIN) });
+				}
+		}
+		else if (kind == "rect")
+		{
+			Rect rectangle;
+			if (sscanf(value.c_str(), "%d:%d:%d:%d", &rectangle.x, &rectangle.y, &rectangle.width, &rectangle.height) == 4)
+				added.push_back({ format("rect%d", rect_index++), rectangle });
+		}
+
+		if (added.empty()) printf("invalid window:%s\n", entry.c_str());
+
+		for (auto& window: added)
+		{
+			window.rectangle &= bounds;
+
+			if (window.rectangle.width > 1 && window.rectangle.height > 1) windows.push_back(window);
+			else printf("empty window:%s\n", window.name.c_str());
+		}
+	}
+
+	return windows;
+}
+
+// assumptions:
+//	img: valid image matrix in opencv
+//	windows: windows inside img
+//	options: grabcut mode, grabcut_threads bounds the concurrent grabcuts, 0 uses one per hardware thread
+//	labels, centers: kmeans result of img the seeded mode starts from, see cluster_stats, empty when there is none
+// outcome: returns the foreground of every window in window order
+vector<Mat> grabcut_windows(const Mat& img, const vector<GrabCutWindow>& windows, const Options& options, const Mat& labels,
+	const Mat& centers)
+{
+	// the cluster statistics are gathered once for all windows
+	optional<ClusterStats> stats;
+	if (options.grabcut == GrabCutMode::SEEDED && !labels.empty()) stats = cluster_stats(img, labels, centers);
+
+	size_t max_threads = options.grabcut_threads;
+	if (max_threads == 0) max_threads = max(1u, thread::hardware_concurrency());
+
+	// every window is an independent single threaded grabcut over the shared read only image
+	ThreadPool pool(min(max_threads, max<size_t>(windows.size(), 1)));
+	vector<future<Mat>> pending;
+
+	for (const auto& window: windows)
+		pending.push_back(pool.submit([&img, &window, &options, &stats]()
+		{
+			return grabcut_window(img, window.rectangle, options, stats ? &*stats : nullptr);
+		}));
+
+	vector<Mat> foregrounds;
+	for (auto& result: pending) foregrounds.push_back(result.get());
+
+	return foregrounds;
+}
@@ -0,0 +1,91 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "options.h"
+
+// rectangle handed to grabcut and the name used in its output file
+struct GrabCutWindow
+{
+	std::string name;
+	cv::Rect rectangle;
+};
+
+// color statistics of the kmeans clusters of an image, computed once and shared by every seeded window
+struct ClusterStats
+{
+	// cluster of every pixel, CV_32S rows x cols
+	cv::Mat labels;
+
+	// pixels, center and covariance around the center of every cluster
+	std::vector<int> counts;
+	std::vector<cv::Vec3d> centers;
+	std::vector<cv::Matx33d> covariances;
+};
+
+// assumptions:
+//	img: CV_8UC3 image
+//	labels: CV_32S cluster of every pixel of img, one per row or rows x cols
+//	centers: CV_32F clusters x 3 centers in the color space of img
+// outcome: returns the pixel count, center and covariance of every cluster
+ClusterStats cluster_stats(const cv::Mat& img, const cv::Mat& labels, const cv::Mat& centers);
+
+// assumptions:
+//	img: valid image matrix in opencv
+//	rectangle: rectangle are smaller than img window 
+// outcome: outputing image with grabcuts segments  
+cv::Mat _grabCut(const cv::Mat& img, cv::Rect rectangle);
+
+// assumptions:
+//	img: CV_8UC3 image
+//	rectangle: window inside img, at least 2 x 2 pixels
+//	coarse_edge: longer side of the coarse level in pixels
+// outcome: returns the foreground of rectangle cropped to its bounding box, black elsewhere in the box,
+//	cut on the window and a margin around it, solved at coarse_edge pixels first and refined at full resolution
+//	only in the band around the coarse edge, a window too thin for the coarse level is cut at full resolution,
+//	a black image of the rectangle when nothing is foreground
+cv::Mat grabcut_pyramid(const cv::Mat& img, cv::Rect rectangle, int coarse_edge);
+
+// assumptions:
+//	img: CV_8UC3 image
+//	rectangle: window inside img
+//	stats: cluster statistics of img
+// outcome: returns the same foreground image as _grabCut, seeded from the clusters instead of a cold rectangle:
+//	clusters denser inside the window than outside it start as probable foreground, the others as probable
+//	background, and both color models start from the cluster statistics, so grabcut skips its own kmeans,
+//	falls back to _grabCut when no cluster seeds one of the models
+cv::Mat grabcut_seeded(const cv::Mat& img, cv::Rect rectangle, const ClusterStats& stats);
+
+// assumptions: stats: cluster statistics of img or nullptr, only used by the seeded mode
+// outcome: returns the foreground of rectangle cut by the grabcut mode of options, the seeded mode without
+//	stats cuts like the full one
+cv::Mat grabcut_window(const cv::Mat& img, cv::Rect rectangle, const Options& options, const ClusterStats* stats = nullptr);
+
+// assumptions:
+//	size: size of the image the windows are placed on
+//	layout: comma separated list of
+//		quadrants: the four image quadrants, named quadrant1 to quadrant4
+//		center[:<fraction>]: centered window covering fraction of each side, 0.75 by default
+//		grid:<rows>x<cols>: rows x cols equal cells, named grid_<row>_<col>
+//		rect:<x>:<y>:<width>:<height>: explicit window, named rect<index>
+// outcome: returns the windows of layout clipped to size, invalid or empty entries are reported and skipped
+std::vector<GrabCutWindow> window_layout(const cv::Size& size, const std::string& layout);
+
+// assumptions:
+//	img: valid image matrix in opencv
+//	windows: windows inside img
+//	options: grabcut mode, grabcut_threads bounds the concurrent grabcuts, 0 uses one per hardware thread
+//	labels, centers: kmeans result of img the seeded mode starts from, see cluster_stats, empty when there is none
+// outcome: returns the foreground of every window in window order
+std::vector<cv::Mat> grabcut_windows(const cv::Mat& img, const std::vector<GrabCutWindow>& windows, const Options& options,
+	const cv::Mat& labels = cv::Mat(), const cv::Mat& centers = cv::Mat());
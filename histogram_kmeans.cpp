@@ -0,0 +1,173 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "histogram_kmeans.h"
+#include "pixel_kmeans.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+const int MIN_HISTOGRAM_BITS = 1;
+const int MAX_HISTOGRAM_BITS = 7;
+
+// pixels each partial histogram should cover so merging stays cheap next to filling
+const size_t PIXELS_PER_BIN = 8;
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	bits: bits kept per channel in [1, 7]
+// outcome: histogram holds the mean color and pixel count of every occupied bin, built in one parallel pass
+void color_histogram(const Mat& image, int bits, ColorHistogram& histogram)
+{
+	CV_Assert(image.type() == CV_8UC3 && image.isContinuous());
+
+	bits = min(max(bits, MIN_HISTOGRAM_BITS), MAX_HISTOGRAM_BITS);
+	const size_t bins = static_cast<size_t>(1) << (3 * bits);
+	const size_t count = image.total();
+	const Vec3b* pixels = image.ptr<Vec3b>();
+
+	// count and channel sums per bin, one table per stripe so the pass needs no atomics
+	const int stripes = static_cast<int>(max<size_t>(1, min<size_t>(static_cast<size_t>(max(getNumThreads(), 1)),
+		count / (bins * PIXELS_PER_BIN))));
+	vector<vector<uint64_t>> partials(stripes);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		for (int stripe = range.start; stripe < range.end; stripe++)
+		{
+			vector<uint64_t>& table = partials[stripe];
+			table.assign(bins * 4, 0);
+
+			for (size_t i = count * stripe / stripes; i < count * (stripe + 1) / stripes; i++)
+			{
+				uint64_t* bin = table.data() + static_cast<size_t>(bin_index(pixels[i], bits)) * 4;
+
+				bin[0]++;
+				bin[1] += pixels[i][0];
+				bin[2] += pixels[i][1];
+				bin[3] += pixels[i][2];
+			}
+		}
+	}, stripes);
+
+	for (int stripe = 1; stripe < stripes; stripe++)
+		for (size_t i = 0; i < partials[0].size(); i++) partials[0][i] += partials[stripe][i];
+
+	const vector<uint64_t>& table = partials[0];
+	size_t occupied = 0;
+	for (size_t bin = 0; bin < bins; bin++) occupied += table[bin * 4] > 0;
+
+	histogram.bits = bits;
+	histogram.colors.create(static_cast<int>(occupied), 3, CV_32F);
+	histogram.weights.create(static_cast<int>(occupied), 1, CV_32F);
+	histogram.rows.assign(bins, -1);
+
+	int row = 0;
+	for (size_t bin = 0; bin < bins; bin++)
+	{
+		const uint64_t* entry = table.data() + bin * 4;
+		if (entry[0] == 0) continue;
+
+		float* color = histogram.colors.ptr<float>(row);
+		for (int c = 0; c < 3; c++) color[c] = static_cast<float>(static_cast<double>(entry[c + 1]) / entry[0]);
+		histogram.weights.at<float>(row) = static_cast<float>(entry[0]);
+		histogram.rows[bin] = row++;
+	}
+}
+
+// assumptions:
+//	image: continuous CV_8UC3 image the histogram was built from
+//	bin_labels: CV_32S matrix with the cluster of every occupied bin, in histogram row order
+// outcome: labels holds the cluster of every pixel as a CV_32S N x 1 matrix, like cv::kmeans, and the
+//	sum of squared distances from every pixel to the mean of its bin is returned
+double histogram_labels(const Mat& image, const ColorHistogram& histogram, const Mat& bin_labels, Mat& labels)
+{
+	// lookup table from bin to cluster, then one pass labels the pixels and measures the quantization error
+	vector<int> lut(histogram.rows.size(), 0);
+	for (size_t bin = 0; bin < lut.size(); bin++)
+		if (histogram.rows[bin] >= 0) lut[bin] = bin_labels.at<int>(histogram.rows[bin]);
+
+	const size_t count = image.total();
+	const Vec3b* pixels = image.ptr<Vec3b>();
+	const int stripes = max(getNumThreads(), 1);
+	vector<double> errors(stripes, 0);
+
+	labels.create(static_cast<int>(count), 1, CV_32S);
+	int* label = labels.ptr<int>();
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		for (int stripe = range.start; stripe < range.end; stripe++)
+		{
+			double error = 0;
+
+			for (size_t i = count * stripe / stripes; i < count * (stripe + 1) / stripes; i++)
+			{
+				const int bin = bin_index(pixels[i], histogram.bits);
+				const float* mean = histogram.colors.ptr<float>(histogram.rows[bin]);
+
+				label[i] = lut[bin];
+				for (int c = 0; c < 3; c++)
+				{
+					const float d = pixels[i][c] - mean[c];
+					error += d * d;
+				}
+			}
+			errors[stripe] = error;
+		}
+	}, stripes);
+
+	double quantization_error = 0;
+	for (double error: errors) quantization_error += error;
+
+	return quantization_error;
+}
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	clusters: number of clusters, at least 1
+//	bits: bits kept per channel in [1, 7]
+//	criteria, attempts, options: see pixel_kmeans
+// outcome:
+//	weighted k-means over the occupied bins of the color histogram of image, so every iteration costs
+//		the number of distinct colors instead of the number of pixels, pixels take the label of their bin
+//	labels: CV_32S N x 1 matrix with the cluster of every pixel, like cv::kmeans
+//	centers: CV_32F clusters x 3 matrix of cluster centers
+//	quantization_error: sum of squared distances from every pixel to the mean of its bin, the labeled
+//		pixels have a compactness of the bin level compactness plus this error, up to rounding
+//	returns the compactness of the pixel labels against centers
+double histogram_kmeans(const Mat& image, int clusters, int bits, TermCriteria criteria, int attempts,
+	const KMeansOptions& options, Mat& labels, Mat& centers, double& quantization_error)
+{
+	CV_Assert(clusters >= 1);
+
+	ColorHistogram histogram;
+	color_histogram(image, bits, histogram);
+
+	// fewer colors than clusters leaves the extra clusters empty, as duplicates of the last color
+	const int occupied = histogram.colors.rows;
+	const int fitted = min(clusters, occupied);
+
+	Mat bin_labels, fitted_centers;
+	const double compactness = pixel_kmeans<3>(histogram.colors, histogram.weights, fitted, bin_labels, criteria, attempts,
+		options, fitted_centers);
+
+	centers.create(clusters, 3, CV_32F);
+	for (int k = 0; k < clusters; k++) fitted_centers.row(min(k, fitted - 1)).copyTo(centers.row(k));
+
+	quantization_error = histogram_labels(image, histogram, bin_labels, labels);
+
+	return compactness + quantization_error;
+}
@@ -0,0 +1,63 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "pixel_kmeans.h"
+
+// occupied bins of a 3 channel color histogram with bits bits per channel
+struct ColorHistogram
+{
+	int bits = 0;
+
+	// CV_32F bins x 3 mean color and CV_32F bins x 1 pixel count of every occupied bin
+	cv::Mat colors;
+	cv::Mat weights;
+
+	// row of colors for every possible bin, -1 when the bin is empty, indexed by bin_index
+	std::vector<int> rows;
+};
+
+// outcome: returns the bin of pixel in a histogram with bits bits per channel
+inline int bin_index(const cv::Vec3b& pixel, int bits)
+{
+	const int shift = 8 - bits;
+	return ((pixel[0] >> shift) << (2 * bits)) | ((pixel[1] >> shift) << bits) | (pixel[2] >> shift);
+}
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	bits: bits kept per channel in [1, 7]
+// outcome: histogram holds the mean color and pixel count of every occupied bin, built in one parallel pass
+void color_histogram(const cv::Mat& image, int bits, ColorHistogram& histogram);
+
+// assumptions:
+//	image: continuous CV_8UC3 image the histogram was built from
+//	bin_labels: CV_32S matrix with the cluster of every occupied bin, in histogram row order
+// outcome: labels holds the cluster of every pixel as a CV_32S N x 1 matrix, like cv::kmeans, and the
+//	sum of squared distances from every pixel to the mean of its bin is returned
+double histogram_labels(const cv::Mat& image, const ColorHistogram& histogram, const cv::Mat& bin_labels, cv::Mat& labels);
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	clusters: number of clusters, at least 1
+//	bits: bits kept per channel in [1, 7]
+//	criteria, attempts, options: see pixel_kmeans
+// outcome:
+//	weighted k-means over the occupied bins of the color histogram of image, so every iteration costs
+//		the number of distinct colors instead of the number of pixels, pixels take the label of their bin
+//	labels: CV_32S N x 1 matrix with the cluster of every pixel, like cv::kmeans
+//	centers: CV_32F clusters x 3 matrix of cluster centers
+//	quantization_error: sum of squared distances from every pixel to the mean of its bin, the labeled
+//		pixels have a compactness of the bin level compactness plus this error, up to rounding
+//	returns the compactness of the pixel labels against centers
+double histogram_kmeans(const cv::Mat& image, int clusters, int bits, cv::TermCriteria criteria, int attempts,
+	const KMeansOptions& options, cv::Mat& labels, cv::Mat& centers, double& quantization_error);
@@ -6,6 +6,7 @@
 //std
 #include <String>
 #include <iostream>
+#include <vector>
 #include <direct.h> 
 
 //opencv
@@ -13,6 +14,9 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 
+//custom
+#include "segments.h"
+
 //namespace
 using namespace cv;
 using namespace std;
@@ -49,12 +53,10 @@ Mat _grabCut(const Mat& img, Rect rectangle) {
 //	cluster_size: integer values: [2-20]
 // outcome: outputing the image into segments and write to disk
 void segmentation(Mat& input, const string& file_dir, const int& cluster_size) {
-	//read in the image and make a copy
-	Mat img = input.clone();
 	// convert image pixel to float & reshape to a [3 x W*H] Mat 
 	//  (so every pixel is on a row of it's own)
 	Mat data;
-	img.convertTo(data, CV_32F);
+	input.convertTo(data, CV_32F);
 	data = data.reshape(1, static_cast<int>(data.total()));
 
 	// do kmeans
@@ -62,40 +64,19 @@ void segmentation(Mat& input, const string& file_dir, const int& cluster_size) {
 	int clusters = cluster_size;
 	kmeans(data, clusters, labels, TermCriteria(TermCriteria::EPS + TermCriteria::MAX_ITER, ITER, EPSILON), ATTEMPTS,
 		KMEANS_RANDOM_CENTERS, centers);
+	data.release();
 
-	// reshape labels and cluster centers to a single row of Vec3f pixels
-	centers = centers.reshape(3, centers.rows);
-	data = data.reshape(3, data.rows);
+	// split the image into one segment per cluster and the image of cluster centers in one pass
+	vector<Mat> segments;
+	Mat img;
+	extract_segments(input, labels, centers, segments, img);
 
 	//for each cluster, outputing the segments 
 	for (int center_id = 0; center_id < clusters; center_id++) {
-		Mat temp = data.clone();
-		Vec3f* pointer = temp.ptr<Vec3f>();
-		for (int i = 0; i < temp.rows; i++) {
-			if (center_id == labels.at<int>(i)) {
-				//pointer[i] = centers.at<Vec3f>(center_id);
-			}
-			else {
-				pointer[i] = Vec3f{ 0,0,0 };
-			}
-		}
 		string output_dir = format("./segments/%s/%s_kmean%d_%d.jpg", file_dir.c_str(), file_dir.c_str(), clusters, center_id);
-		temp = temp.reshape(3, img.rows);
-		temp.convertTo(temp, CV_8U);
-		imwrite(output_dir, temp);
-	}
-
-	// replace pixel values with their center value:
-	Vec3f* p = data.ptr<Vec3f>();
-	for (int i = 0; i < data.rows; i++) {
-		int center_id = labels.at<int>(i);
-		p[i] = centers.at<Vec3f>(center_id);
+		imwrite(output_dir, segments[center_id]);
 	}
 
-	// back to 2d, and uchar:
-	img = data.reshape(3, img.rows);
-	img.convertTo(img, CV_8U);
-
 	//display the k mean result and output into the segment directory
 	//namedWindow("Original Image");
 	//imshow("Original Image", ocv);
@@ -0,0 +1,334 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// custom
+#include "label_cache.h"
+
+// namespaces
+using namespace std;
+
+// global constants
+const char CACHE_MAGIC[4] = { 'S', 'C', 'L', 'C' };
+const uint32_t CACHE_VERSION = 2;
+
+// label count of a record that only marks its key as recently used
+const uint32_t TOUCH_RECORD = 0xffffffff;
+
+// records a small cache may reach before stale ones are worth a rewrite
+const size_t MIN_COMPACT_RECORDS = 1024;
+
+// limits of one record, anything larger is a damaged file rather than a vision api answer
+const uint32_t MAX_RECORD_LABELS = 1024;
+const uint16_t MAX_DESCRIPTION_BYTES = 1024;
+
+const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotate_left(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t hash_round(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * PRIME2;
+	return rotate_left(accumulator, 31) * PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t accumulator, uint64_t value)
+{
+	accumulator ^= hash_round(0, value);
+	return accumulator * PRIME1 + PRIME4;
+}
+
+// outcome: returns a 64 bit xxhash of length bytes of data
+uint64_t hash64(const void* data, size_t length, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + length;
+	uint64_t hash;
+
+	if (length >= 32)
+	{
+		uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+
+		for (; end - p >= 32; p += 32)
+		{
+			v1 = hash_round(v1, read64(p));
+			v2 = hash_round(v2, read64(p + 8));
+			v3 = hash_round(v3, read64(p + 16));
+			v4 = hash_round(v4, read64(p + 24));
+		}
+
+		hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+		hash = hash_merge(hash, v1);
+		hash = hash_merge(hash, v2);
+		hash = hash_merge(hash, v3);
+		hash = hash_merge(hash, v4);
+	}
+	else hash = seed + PRIME5;
+
+	hash += length;
+
+	for (; end - p >= 8; p += 8) hash = rotate_left(hash ^ hash_round(0, read64(p)), 27) * PRIME1 + PRIME4;
+	for (; end - p >= 4; p += 4) hash = rotate_left(hash ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+	for (; p < end; p++) hash = rotate_left(hash ^ (*p * PRIME5), 11) * PRIME1;
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+// assumptions:
+//	path: cache file, created when missing
+//	max_entries: upper bound of cached images
+// outcome: cache holds the entries stored in path
+LabelCache::LabelCache(const string& path, size_t max_entries)
+	: path(path), max_entries(max(max_entries, static_cast<size_t>(1)))
+{
+	error_code error;
+	const filesystem::path parent = filesystem::path(path).parent_path();
+	if (!parent.empty()) filesystem::create_directories(parent, error);
+
+	// a log full of stale records, or of an older format, is rewritten before it is appended to
+	if (!load() || stale()) compact();
+	else log.open(path, ios::binary | ios::app);
+}
+
+// outcome: returns the key of an encoded image requested with parameters
+uint64_t LabelCache::key(const string& encoding, const string& parameters)
+{
+	return hash64(encoding.data(), encoding.size(), hash64(parameters.data(), parameters.size()));
+}
+
+// outcome: returns true and fills labels, interned in store, when key is cached, counts a hit or a miss
+bool LabelCache::find(uint64_t key, LabelStore& store, vector<ScoredLabel>& labels)
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	auto found = index.find(key);
+	if (found == index.end())
+	{
+		miss_count++;
+		return false;
+	}
+
+	hit_count++;
+	entries.splice(entries.begin(), entries, found->second);
+	for (const auto& label: found->second->labels)
+		labels.push_back({ store.intern(label.description), label.score, label.topicality });
+	append(*found->second, true);
+	if (stale()) compact();
+
+	return true;
+}
+
+// outcome: labels are cached under key with their scores and appended to the cache file
+void LabelCache::insert(uint64_t key, const LabelStore& store, const vector<ScoredLabel>& labels)
+{
+	Entry entry{ key, {} };
+	for (const auto& label: labels) entry.labels.push_back({ store.description(label.id), label.score, label.topicality });
+
+	lock_guard<std::mutex> lock(mutex);
+
+	auto found = index.find(key);
+	if (found != index.end())
+	{
+		entries.erase(found->second);
+		index.erase(found);
+	}
+
+	entries.push_front(move(entry));
+	index[key] = entries.begin();
+	append(entries.front(), false);
+	evict();
+	if (stale()) compact();
+}
+
+// outcome: cache file rewritten with only the live entries, oldest first
+void LabelCache::compact()
+{
+	if (log.is_open()) log.close();
+
+	// written next to the cache and swapped in so an interrupted compaction keeps the old file
+	const string temporary = path + ".tmp";
+	log.open(temporary, ios::binary | ios::trunc);
+	log.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	log.write(reinterpret_cast<const char*>(&CACHE_VERSION), sizeof(CACHE_VERSION));
+
+	records = 0;
+	for (auto entry = entries.rbegin(); entry != entries.rend(); entry++) append(*entry, false);
+	log.close();
+
+	error_code error;
+	filesystem::rename(temporary, path, error);
+	if (error) printf("cache compaction failure:%s\n", error.message().c_str());
+
+	log.open(path, ios::binary | ios::app);
+}
+
+size_t LabelCache::hits() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return hit_count;
+}
+
+size_t LabelCache::misses() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return miss_count;
+}
+
+size_t LabelCache::size() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+// outcome: entries replayed from the cache file up to the last complete record, returns false when the file is
+//	missing, of another format, or ends in a truncated or damaged record so it is compacted before anything is
+//	appended behind the partial bytes
+bool LabelCache::load()
+{
+	ifstream file(path, ios::binary);
+	char magic[sizeof(CACHE_MAGIC)];
+	uint32_t version = 0;
+
+	if (!file.read(magic, sizeof(magic)) || !file.read(reinterpret_cast<char*>(&version), sizeof(version))) return false;
+	if (memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || version != CACHE_VERSION)
+	{
+		printf("cache format mismatch:%s\n", path.c_str());
+		return false;
+	}
+
+	// counts and lengths are checked before anything is allocated for them
+	auto read_labels = [&file](Entry& entry, uint32_t count)
+	{
+		if (count > MAX_RECORD_LABELS) return false;
+
+		entry.labels.resize(count);
+		for (auto& label: entry.labels)
+		{
+			uint16_t length = 0;
+			if (!file.read(reinterpret_cast<char*>(&length), sizeof(length)) || length > MAX_DESCRIPTION_BYTES) return false;
+
+			label.description.resize(length);
+			if (length > 0 && !file.read(&label.description[0], length)) return false;
+			if (!file.read(reinterpret_cast<char*>(&label.score), sizeof(label.score))) return false;
+			if (!file.read(reinterpret_cast<char*>(&label.topicality), sizeof(label.topicality))) return false;
+		}
+
+		return true;
+	};
+
+	for (;;)
+	{
+		Entry entry;
+		uint32_t count;
+
+		// the file only ends cleanly between two records
+		if (!file.read(reinterpret_cast<char*>(&entry.key), sizeof(entry.key)))
+		{
+			if (file.gcount() == 0) break;
+
+			printf("cache truncated:%s\n", path.c_str());
+			return false;
+		}
+
+		if (!file.read(reinterpret_cast<char*>(&count), sizeof(count)) || (count != TOUCH_RECORD && !read_labels(entry, count)))
+		{
+			printf("cache truncated:%s\n", path.c_str());
+			return false;
+		}
+		records++;
+
+		// replaying in file order leaves the most recent record of every key in front
+		auto found = index.find(entry.key);
+		if (count == TOUCH_RECORD)
+		{
+			if (found != index.end()) entries.splice(entries.begin(), entries, found->second);
+			continue;
+		}
+		if (found != index.end()) entries.erase(found->second);
+
+		entries.push_front(move(entry));
+		index[entries.front().key] = entries.begin();
+		evict();
+	}
+
+	return true;
+}
+
+// outcome: whether the cache file holds more than twice as many records as there are live entries,
+//	so a long running process rewrites it instead of growing it forever
+bool LabelCache::stale() const
+{
+	return records > 2 * max(entries.size(), MIN_COMPACT_RECORDS);
+}
+
+// outcome: entry written to the end of the cache file, touch records only hold the key and are left buffered,
+//	losing a few of them in a crash only loses recency
+void LabelCache::append(const Entry& entry, bool touch)
+{
+	if (!log.is_open()) return;
+
+	const uint32_t count = touch ? TOUCH_RECORD : static_cast<uint32_t>(entry.labels.size());
+	log.write(reinterpret_cast<const char*>(&entry.key), sizeof(entry.key));
+	log.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	if (!touch)
+		for (const auto& label: entry.labels)
+		{
+			const uint16_t length = static_cast<uint16_t>(min(label.description.size(), static_cast<size_t>(MAX_DESCRIPTION_BYTES)));
+			log.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			log.write(label.description.data(), length);
+			log.write(reinterpret_cast<const char*>(&label.score), sizeof(label.score));
+			log.write(reinterpret_cast<const char*>(&label.topicality), sizeof(label.topicality));
+		}
+
+	if (!touch) log.flush();
+	records++;
+}
+
+// outcome: least recently used entries dropped until the cache fits max_entries
+void LabelCache::evict()
+{
+	while (entries.size() > max_entries)
+	{
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
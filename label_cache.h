@@ -0,0 +1,85 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// custom
+#include "label_store.h"
+
+// outcome: returns a 64 bit xxhash of length bytes of data
+uint64_t hash64(const void* data, size_t length, uint64_t seed = 0);
+
+// persistent cache of vision api labels keyed by image content and request parameters
+//	file: append only log of insert and touch records, replayed on load and compacted on load or while running
+//		once it holds twice as many records as the cache holds entries
+//	eviction: least recently used entry once max_entries is reached, recency survives restarts
+class LabelCache
+{
+public:
+	// assumptions:
+	//	path: cache file, created when missing
+	//	max_entries: upper bound of cached images
+	// outcome: cache holds the entries stored in path
+	LabelCache(const std::string& path, size_t max_entries);
+
+	LabelCache(const LabelCache&) = delete;
+	LabelCache& operator=(const LabelCache&) = delete;
+
+	// outcome: returns the key of an encoded image requested with parameters
+	static uint64_t key(const std::string& encoding, const std::string& parameters);
+
+	// outcome: returns true and fills labels, interned in store, when key is cached, counts a hit or a miss
+	bool find(uint64_t key, LabelStore& store, std::vector<ScoredLabel>& labels);
+
+	// outcome: labels are cached under key with their scores and appended to the cache file
+	void insert(uint64_t key, const LabelStore& store, const std::vector<ScoredLabel>& labels);
+
+	// outcome: cache file rewritten with only the live entries, oldest first
+	void compact();
+
+	size_t hits() const;
+	size_t misses() const;
+	size_t size() const;
+
+private:
+	// labels are kept as text, ids are only meaningful within one store
+	struct Label
+	{
+		std::string description;
+		float score;
+		float topicality;
+	};
+
+	struct Entry
+	{
+		uint64_t key;
+		std::vector<Label> labels;
+	};
+
+	bool load();
+	bool stale() const;
+	void append(const Entry& entry, bool touch);
+	void evict();
+
+	std::string path;
+	size_t max_entries;
+	size_t records = 0;
+	size_t hit_count = 0;
+	size_t miss_count = 0;
+
+	// most recently used entry first
+	std::list<Entry> entries;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+	std::ofstream log;
+	mutable std::mutex mutex;
+};
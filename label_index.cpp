@@ -0,0 +1,606 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// custom
+#include "label_index.h"
+#include "label_store.h"
+
+// namespaces
+using namespace std;
+
+// file layout, every record is a multiple of 4 bytes so the mapped records stay aligned,
+// numbers are stored in the byte order of the machine, little endian on every supported target
+struct IndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct ChunkHeader
+{
+	uint32_t magic;
+
+	// bytes of the chunk, header included
+	uint32_t size;
+	uint32_t images;
+	uint32_t descriptions;
+	uint32_t postings;
+	uint32_t strings;
+};
+
+// bytes of the string table of a chunk
+struct StringRef
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+// first and count select the image postings of the image, parent is the image a segment was cut from
+struct ImageRecord
+{
+	StringRef parent;
+	StringRef set;
+	StringRef name;
+	uint32_t first;
+	uint32_t count;
+};
+
+// first and count select the postings of the description
+struct DescriptionRecord
+{
+	StringRef text;
+	uint32_t first;
+	uint32_t count;
+};
+
+struct PostingRecord
+{
+	uint32_t image;
+	uint32_t description;
+	float max_score;
+	float mean_score;
+	uint32_t count;
+};
+
+static_assert(sizeof(ChunkHeader) % 4 == 0 && sizeof(ImageRecord) % 4 == 0 && sizeof(DescriptionRecord) % 4 == 0
+	&& sizeof(PostingRecord) % 4 == 0, "label index records must keep 4 byte alignment");
+
+// global constants
+const uint32_t INDEX_MAGIC = 0x58444e49;
+const uint32_t INDEX_VERSION = 2;
+const uint32_t CHUNK_MAGIC = 0x4b4e4843;
+const size_t MAX_CHUNKS = 64;
+
+// records of one chunk, laid out in this order after its header: images, descriptions, postings by
+// description, posting indices by image and the string table padded to 4 bytes
+struct ChunkView
+{
+	const ImageRecord* images;
+	const DescriptionRecord* descriptions;
+	const PostingRecord* postings;
+	const uint32_t* image_postings;
+	const char* strings;
+	uint32_t image_count;
+	uint32_t description_count;
+	uint32_t posting_count;
+	uint32_t string_bytes;
+
+	string_view text(const StringRef& ref) const
+	{
+		if (ref.offset > string_bytes || ref.length > string_bytes - ref.offset) return string_view();
+		return string_view(strings + ref.offset, ref.length);
+	}
+};
+
+// outcome: returns the bytes a chunk with the counts of header takes, string table padded to 4 bytes
+static size_t chunk_size(const ChunkHeader& header)
+{
+	return sizeof(ChunkHeader) + header.images * sizeof(ImageRecord) + header.descriptions * sizeof(DescriptionRecord)
+		+ static_cast<size_t>(header.postings) * (sizeof(PostingRecord) + sizeof(uint32_t)) + ((header.strings + 3) & ~3u);
+}
+
+// assumptions: data: start of a chunk whose size was checked against chunk_size
+// outcome: returns the records of the chunk, pointing into data
+static ChunkView chunk_view(const unsigned char* data)
+{
+	const ChunkHeader* header = reinterpret_cast<const ChunkHeader*>(data);
+	ChunkView view;
+
+	data += sizeof(ChunkHeader);
+	view.images = reinterpret_cast<const ImageRecord*>(data);
+	data += header->images * sizeof(ImageRecord);
+	view.descriptions = reinterpret_cast<const DescriptionRecord*>(data);
+	data += header->descriptions * sizeof(DescriptionRecord);
+	view.postings = reinterpret_cast<const PostingRecord*>(data);
+	data += header->postings * sizeof(PostingRecord);
+	view.image_postings = reinterpret_cast<const uint32_t*>(data);
+	data += header->postings * sizeof(uint32_t);
+	view.strings = reinterpret_cast<const char*>(data);
+
+	view.image_count = header->images;
+	view.description_count = header->descriptions;
+	view.posting_count = header->postings;
+	view.string_bytes = header->strings;
+
+	return view;
+}
+
+// outcome: returns whether every string, posting range and record index of view stays inside its chunk,
+//	so queries can follow them without checking again
+static bool chunk_valid(const ChunkView& view)
+{
+	auto string_valid = [&](const StringRef& ref) { return ref.offset <= view.string_bytes && ref.length <= view.string_bytes - ref.offset; };
+	auto range_valid = [&](uint32_t first, uint32_t count) { return first <= view.posting_count && count <= view.posting_count - first; };
+
+	for (uint32_t i = 0; i < view.image_count; i++)
+	{
+		const ImageRecord& image = view.images[i];
+		if (!string_valid(image.parent) || !string_valid(image.set) || !string_valid(image.name)) return false;
+		if (!range_valid(image.first, image.count)) return false;
+	}
+
+	for (uint32_t d = 0; d < view.description_count; d++)
+	{
+		const DescriptionRecord& description = view.descriptions[d];
+		if (!string_valid(description.text) || !range_valid(description.first, description.count)) return false;
+	}
+
+	for (uint32_t p = 0; p < view.posting_count; p++)
+	{
+		const PostingRecord& posting = view.postings[p];
+		if (posting.image >= view.image_count || posting.description >= view.description_count) return false;
+		if (view.image_postings[p] >= view.posting_count) return false;
+	}
+
+	return true;
+}
+
+// outcome: returns the range of images of view cut from parent, in set and name order
+static pair<const ImageRecord*, const ImageRecord*> find_images(const ChunkView& view, string_view parent)
+{
+	const ImageRecord* first = view.images;
+	const ImageRecord* last = first + view.image_count;
+
+	return { lower_bound(first, last, parent, [&](const ImageRecord& record, string_view key) { return view.text(record.parent) < key; }),
+		upper_bound(first, last, parent, [&](string_view key, const ImageRecord& record) { return key < view.text(record.parent); }) };
+}
+
+// labels of every image keyed by parent, set and name, sorted, as a chunk is built from them
+struct StoredLabel
+{
+	string description;
+	float max_score;
+	float mean_score;
+	uint32_t count;
+};
+using StoredImages = map<tuple<string, string, string>, vector<StoredLabel>>;
+
+// outcome: returns the bytes of one chunk holding images
+static vector<unsigned char> build_chunk(const StoredImages& images)
+{
+	string strings;
+	unordered_map<string, StringRef> interned;
+	auto intern = [&](const string& text)
+	{
+		auto [found, inserted] = interned.insert({ text, StringRef{ static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size()) } });
+		if (inserted) strings += text;
+		return found->second;
+	};
+
+	// descriptions in byte order, each with its images in image order
+	map<string, vector<pair<uint32_t, const StoredLabel*>>> by_description;
+	vector<ImageRecord> image_records;
+
+	for (const auto& [key, labels]: images)
+	{
+		const uint32_t image = static_cast<uint32_t>(image_records.size());
+		image_records.push_back({ intern(get<0>(key)), intern(get<1>(key)), intern(get<2>(key)), 0, 0 });
+		for (const auto& label: labels) by_description[label.description].push_back({ image, &label });
+	}
+
+	vector<DescriptionRecord> description_records;
+	vector<PostingRecord> postings;
+	vector<vector<uint32_t>> image_lists(image_records.size());
+
+	for (const auto& [description, holders]: by_description)
+	{
+		const uint32_t index = static_cast<uint32_t>(description_records.size());
+		description_records.push_back({ intern(description), static_cast<uint32_t>(postings.size()), static_cast<uint32_t>(holders.size()) });
+
+		for (const auto& [image, label]: holders)
+		{
+			image_lists[image].push_back(static_cast<uint32_t>(postings.size()));
+			postings.push_back({ image, index, label->max_score, label->mean_score, label->count });
+		}
+	}
+
+	vector<uint32_t> image_postings;
+	for (size_t i = 0; i < image_records.size(); i++)
+	{
+		image_records[i].first = static_cast<uint32_t>(image_postings.size());
+		image_records[i].count = static_cast<uint32_t>(image_lists[i].size());
+		image_postings.insert(image_postings.end(), image_lists[i].begin(), image_lists[i].end());
+	}
+
+	ChunkHeader header{ CHUNK_MAGIC, 0, static_cast<uint32_t>(image_records.size()), static_cast<uint32_t>(description_records.size()),
+		static_cast<uint32_t>(postings.size()), static_cast<uint32_t>(strings.size()) };
+	header.size = static_cast<uint32_t>(chunk_size(header));
+
+	vector<unsigned char> chunk(header.size, 0);
+	unsigned char* out = chunk.data();
+	auto put = [&out](const void* data, size_t bytes)
+	{
+		if (bytes > 0) memcpy(out, data, bytes);
+		out += bytes;
+	};
+
+	put(&header, sizeof(header));
+	put(image_records.data(), image_records.size() * sizeof(ImageRecord));
+	put(description_records.data(), description_records.size() * sizeof(DescriptionRecord));
+	put(postings.data(), postings.size() * sizeof(PostingRecord));
+	put(image_postings.data(), image_postings.size() * sizeof(uint32_t));
+	put(strings.data(), strings.size());
+
+	return chunk;
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+// outcome: the whole of path is mapped, returns false when it is missing or empty
+bool MappedFile::map(const string& path)
+{
+	unmap();
+
+#if defined(_WIN32)
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE section = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* mapped = section ? MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!mapped)
+	{
+		if (section) CloseHandle(section);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file = handle;
+	mapping = section;
+	length = static_cast<size_t>(size.QuadPart);
+#else
+	const int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) return false;
+
+	struct stat status;
+	void* mapped = fstat(descriptor, &status) == 0 && status.st_size > 0
+		? mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+	close(descriptor);
+	if (mapped == MAP_FAILED) return false;
+
+	length = static_cast<size_t>(status.st_size);
+#endif
+
+	view = static_cast<const unsigned char*>(mapped);
+	return true;
+}
+
+// outcome: mapping released
+void MappedFile::unmap()
+{
+	if (!view) return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(view);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	file = mapping = nullptr;
+#else
+	munmap(const_cast<unsigned char*>(view), length);
+#endif
+
+	view = nullptr;
+	length = 0;
+}
+
+// assumptions: path: index file, created when missing unless read_only
+// outcome: index maps the chunks stored in path, a truncated final chunk is dropped,
+//	a read only index never writes path, is_open tells whether it could be read
+LabelIndex::LabelIndex(const string& path, bool read_only)
+	: path(path), read_only(read_only)
+{
+	if (read_only)
+	{
+		load();
+		return;
+	}
+
+	error_code error;
+	const filesystem::path parent = filesystem::path(path).parent_path();
+	if (!parent.empty()) filesystem::create_directories(parent, error);
+
+	// a truncated, missing or foreign file is rewritten from the chunks that could be read
+	if (!load() || chunk_views.size() > MAX_CHUNKS) rewrite();
+}
+
+// outcome: whether path holds a label index of this format
+bool LabelIndex::is_open() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return opened;
+}
+
+// assumptions: set: name the labels are stored under, ex base_labels
+// outcome: labels of every image of store appended as one chunk under its directory as parent, returns false
+//	when the file cannot be written or the index is read only
+bool LabelIndex::append(const LabelStore& store, const string& set)
+{
+	if (read_only) return false;
+
+	StoredImages images;
+	for (const auto& [image, labels]: store.image_snapshot())
+	{
+		vector<StoredLabel>& stored = images[{ image.first, set, image.second }];
+		for (const auto& [description, stats]: labels)
+			stored.push_back({ description, stats.max_score, static_cast<float>(stats.mean_score()), stats.count });
+	}
+
+	if (images.empty()) return true;
+
+	lock_guard<std::mutex> lock(mutex);
+	if (!write(build_chunk(images), false)) return false;
+
+	return chunk_views.size() < MAX_CHUNKS || rewrite();
+}
+
+// outcome: returns the images and segments carrying description with their statistics,
+//	in parent, name and set order
+vector<LabelPosting> LabelIndex::find(string_view description) const
+{
+	lock_guard<std::mutex> lock(mutex);
+	vector<LabelPosting> found;
+
+	for (size_t chunk = 0; chunk < chunk_views.size(); chunk++)
+	{
+		const ChunkView view = chunk_view(chunk_views[chunk].data);
+		const DescriptionRecord* first = view.descriptions;
+		const DescriptionRecord* last = first + view.description_count;
+
+		const DescriptionRecord* match = lower_bound(first, last, description,
+			[&](const DescriptionRecord& record, string_view key) { return view.text(record.text) < key; });
+		if (match == last || view.text(match->text) != description) continue;
+
+		for (uint32_t i = match->first; i < match->first + match->count; i++)
+		{
+			const PostingRecord& posting = view.postings[i];
+			const ImageRecord& image = view.images[posting.image];
+			const string_view parent = view.text(image.parent), set = view.text(image.set);
+
+			if (superseded(chunk, parent, set)) continue;
+			found.push_back({ string(view.text(image.name)), string(parent), string(set), string(description), posting.max_score,
+				posting.mean_score, posting.count });
+		}
+	}
+
+	sort(found.begin(), found.end(), [](const LabelPosting& a, const LabelPosting& b)
+	{
+		return tie(a.parent, a.name, a.set) < tie(b.parent, b.name, b.set);
+	});
+	return found;
+}
+
+// outcome: returns the labels of parent and of every segment cut from it under every set,
+//	in set, name and description order
+vector<LabelPosting> LabelIndex::labels(string_view parent) const
+{
+	lock_guard<std::mutex> lock(mutex);
+	vector<LabelPosting> found;
+	set<string_view> sets;
+
+	// newest chunk first, so the latest images of every set win and older chunks only fill in the other sets
+	for (size_t chunk = chunk_views.size(); chunk-- > 0;)
+	{
+		const ChunkView view = chunk_view(chunk_views[chunk].data);
+		const auto [first, last] = find_images(view, parent);
+		set<string_view> chunk_sets;
+
+		for (const ImageRecord* image = first; image != last; image++)
+		{
+			const string_view set = view.text(image->set);
+			if (sets.count(set)) continue;
+			chunk_sets.insert(set);
+
+			for (uint32_t i = image->first; i < image->first + image->count; i++)
+			{
+				const PostingRecord& posting = view.postings[view.image_postings[i]];
+				found.push_back({ string(view.text(image->name)), string(parent), string(set),
+					string(view.text(view.descriptions[posting.description].text)), posting.max_score, posting.mean_score,
+					posting.count });
+			}
+		}
+		sets.insert(chunk_sets.begin(), chunk_sets.end());
+	}
+
+	stable_sort(found.begin(), found.end(), [](const LabelPosting& a, const LabelPosting& b) { return tie(a.set, a.name) < tie(b.set, b.name); });
+	return found;
+}
+
+// outcome: index file rewritten as a single chunk holding only the live postings
+bool LabelIndex::compact()
+{
+	if (read_only) return false;
+
+	lock_guard<std::mutex> lock(mutex);
+	return rewrite();
+}
+
+// outcome: number of chunks mapped
+size_t LabelIndex::chunks() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return chunk_views.size();
+}
+
+// outcome: chunks replayed from the mapped file in append order, every offset and count checked against the
+//	mapped size, returns false when the file is missing, of another format, ends in a truncated chunk or holds
+//	a damaged one, the chunks before it stay mapped
+bool LabelIndex::load()
+{
+	chunk_views.clear();
+	opened = false;
+	if (!file.map(path)) return false;
+
+	const unsigned char* data = file.data();
+	const size_t size = file.size();
+
+	const IndexHeader* header = reinterpret_cast<const IndexHeader*>(data);
+	if (size < sizeof(IndexHeader) || header->magic != INDEX_MAGIC || header->version != INDEX_VERSION)
+	{
+		printf("label index format mismatch:%s\n", path.c_str());
+		return false;
+	}
+	opened = true;
+
+	for (size_t offset = sizeof(IndexHeader); offset < size;)
+	{
+		// an interrupted append leaves a final chunk shorter than its header says
+		if (size - offset < sizeof(ChunkHeader)) return false;
+
+		const ChunkHeader* chunk = reinterpret_cast<const ChunkHeader*>(data + offset);
+		if (chunk->magic != CHUNK_MAGIC || chunk->size != chunk_size(*chunk) || chunk->size > size - offset) return false;
+
+		// a damaged chunk would send queries outside of the mapping, it is dropped with every chunk after it
+		if (!chunk_valid(chunk_view(data + offset)))
+		{
+			printf("label index corrupt chunk:%s\n", path.c_str());
+			return false;
+		}
+
+		chunk_views.push_back({ data + offset, chunk->size });
+		offset += chunk->size;
+	}
+
+	return true;
+}
+
+// outcome: the live postings of every mapped chunk written as one chunk in place of the file
+bool LabelIndex::rewrite()
+{
+	StoredImages images;
+	set<pair<string, string>> taken;
+
+	// newest chunk first, a parent and set stored by a newer chunk drops every older image of it
+	for (size_t chunk = chunk_views.size(); chunk-- > 0;)
+	{
+		const ChunkView view = chunk_view(chunk_views[chunk].data);
+		set<pair<string, string>> chunk_taken;
+
+		for (uint32_t i = 0; i < view.image_count; i++)
+		{
+			const ImageRecord& image = view.images[i];
+			pair<string, string> key{ string(view.text(image.parent)), string(view.text(image.set)) };
+			if (taken.count(key)) continue;
+
+			vector<StoredLabel>& stored = images[{ key.first, key.second, string(view.text(image.name)) }];
+			for (uint32_t p = image.first; p < image.first + image.count; p++)
+			{
+				const PostingRecord& posting = view.postings[view.image_postings[p]];
+				stored.push_back({ string(view.text(view.descriptions[posting.description].text)), posting.max_score,
+					posting.mean_score, posting.count });
+			}
+			chunk_taken.insert(move(key));
+		}
+		taken.insert(chunk_taken.begin(), chunk_taken.end());
+	}
+
+	return write(images.empty() ? vector<unsigned char>() : build_chunk(images), true);
+}
+
+// outcome: chunk appended to the file, or written as its only chunk when truncate, and the file mapped again,
+//	returns false when it cannot be written
+bool LabelIndex::write(const vector<unsigned char>& chunk, bool truncate)
+{
+	// the mapping is released first, windows refuses to replace a mapped file
+	chunk_views.clear();
+	file.unmap();
+
+	// a rewrite goes to a file next to the index that is swapped in, so an interruption keeps the old one
+	const string target = truncate ? path + ".tmp" : path;
+	ofstream out(target, ios::binary | (truncate ? ios::trunc : ios::app));
+
+	if (truncate)
+	{
+		const IndexHeader header{ INDEX_MAGIC, INDEX_VERSION };
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+	out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	out.close();
+
+	bool success = static_cast<bool>(out);
+	if (success && truncate)
+	{
+		error_code error;
+		filesystem::rename(target, path, error);
+		success = !error;
+	}
+
+	if (!success) printf("label index write failure:%s\n", path.c_str());
+	load();
+
+	return success;
+}
+
+// outcome: returns whether a chunk newer than chunk holds images of parent under set
+bool LabelIndex::superseded(size_t chunk, string_view parent, string_view set) const
+{
+	for (size_t newer = chunk + 1; newer < chunk_views.size(); newer++)
+	{
+		const ChunkView view = chunk_view(chunk_views[newer].data);
+		const auto [first, last] = find_images(view, parent);
+
+		for (const ImageRecord* image = first; image != last; image++)
+			if (view.text(image->set) == set) return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,119 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// custom
+#include "label_store.h"
+
+// labels of one image or segment as stored in a LabelIndex
+struct LabelPosting
+{
+	// id of the image or segment the labels belong to, the image it was cut from and the set the labels were
+	//	stored under, ex base_labels
+	std::string name;
+	std::string parent;
+	std::string set;
+
+	std::string description;
+	float max_score;
+	float mean_score;
+	uint32_t count;
+};
+
+// read only view of a file mapped into memory
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// outcome: the whole of path is mapped, returns false when it is missing or empty
+	bool map(const std::string& path);
+
+	// outcome: mapping released
+	void unmap();
+
+	const unsigned char* data() const { return view; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char* view = nullptr;
+	size_t length = 0;
+	void* file = nullptr;
+	void* mapping = nullptr;
+};
+
+// binary label index of every labeled image and segment, memory mapped and queried in place
+//	file: header followed by append only chunks, one per stored LabelStore, every chunk holds its images
+//		sorted by parent, set and name, its interned descriptions sorted for binary search, the postings of every
+//		description and the postings of every image, all fixed size little endian records
+//	an image whose parent is stored again under the same set is replaced by the newer images of that parent,
+//		so a parent cut into other segments drops its old ones, chunks are merged into one once there are
+//		MAX_CHUNKS of them
+//	loading maps the file, walks the chunk headers and checks every record against the bounds of its chunk,
+//		nothing is parsed or copied
+class LabelIndex
+{
+public:
+	// assumptions: path: index file, created when missing unless read_only
+	// outcome: index maps the chunks stored in path, a truncated final chunk is dropped,
+	//	a read only index never writes path, is_open tells whether it could be read
+	LabelIndex(const std::string& path, bool read_only = false);
+
+	LabelIndex(const LabelIndex&) = delete;
+	LabelIndex& operator=(const LabelIndex&) = delete;
+
+	// outcome: whether path holds a label index of this format
+	bool is_open() const;
+
+	// assumptions: set: name the labels are stored under, ex base_labels
+	// outcome: labels of every image of store appended as one chunk under its directory as parent, returns false
+	//	when the file cannot be written or the index is read only
+	bool append(const LabelStore& store, const std::string& set);
+
+	// outcome: returns the images and segments carrying description with their statistics,
+	//	in parent, name and set order
+	std::vector<LabelPosting> find(std::string_view description) const;
+
+	// outcome: returns the labels of parent and of every segment cut from it under every set,
+	//	in set, name and description order
+	std::vector<LabelPosting> labels(std::string_view parent) const;
+
+	// outcome: index file rewritten as a single chunk holding only the live postings, returns false when it
+	//	cannot be written or the index is read only
+	bool compact();
+
+	// outcome: number of chunks mapped
+	size_t chunks() const;
+
+private:
+	struct Chunk
+	{
+		const unsigned char* data;
+		size_t size;
+	};
+
+	bool load();
+	bool rewrite();
+	bool write(const std::vector<unsigned char>& chunk, bool truncate);
+	bool superseded(size_t chunk, std::string_view parent, std::string_view set) const;
+
+	std::string path;
+	bool read_only;
+	bool opened = false;
+	MappedFile file;
+	std::vector<Chunk> chunk_views;
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,449 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// custom
+#include "label_store.h"
+
+// namespaces
+using namespace std;
+
+// outcome: returns the id of description, assigned on first use
+uint32_t LabelStore::intern(string_view description)
+{
+	{
+		shared_lock<shared_mutex> lock(intern_mutex);
+		auto found = ids.find(description);
+		if (found != ids.end()) return found->second;
+	}
+
+	unique_lock<shared_mutex> lock(intern_mutex);
+
+	// another thread may have interned it between the two locks
+	auto found = ids.find(description);
+	if (found != ids.end()) return found->second;
+
+	const uint32_t id = static_cast<uint32_t>(descriptions.size());
+	descriptions.emplace_back(description);
+	ids.emplace(descriptions.back(), id);
+
+	return id;
+}
+
+// assumptions: id: returned by intern of this store
+// outcome: returns the description of id
+const string& LabelStore::description(uint32_t id) const
+{
+	shared_lock<shared_mutex> lock(intern_mutex);
+	return descriptions[id];
+}
+
+// outcome: directory is reported even when none of its images get labels
+void LabelStore::add_directory(const string& directory)
+{
+	lock_guard<mutex> lock(directory_mutex);
+	directories[directory];
+}
+
+// assumptions: image: id of the image within directory, ex the segment name
+// outcome: labels of image counted towards the statistics of directory and kept as the labels of image
+void LabelStore::merge(const string& directory, const string& image, const vector<ScoredLabel>& labels)
+{
+	lock_guard<mutex> lock(directory_mutex);
+	auto& statistics = directories[directory];
+	auto& image_statistics = images[{ directory, image }];
+
+	for (const auto& label: labels)
+		for (LabelStats* stats: { &statistics[label.id], &image_statistics[label.id] })
+		{
+			stats->max_score = max(stats->max_score, label.score);
+			stats->score_sum += label.score;
+			stats->count++;
+		}
+}
+
+// outcome: returns statistics as labels in description order
+vector<pair<string, LabelStats>> LabelStore::sorted(const unordered_map<uint32_t, LabelStats>& statistics) const
+{
+	vector<pair<string, LabelStats>> labels;
+	labels.reserve(statistics.size());
+
+	for (const auto& [id, stats]: statistics) labels.push_back({ description(id), stats });
+	sort(labels.begin(), labels.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	return labels;
+}
+
+// outcome: every directory in name order with its labels in description order
+map<string, vector<pair<string, LabelStats>>> LabelStore::snapshot() const
+{
+	map<string, vector<pair<string, LabelStats>>> result;
+	lock_guard<mutex> lock(directory_mutex);
+
+	for (const auto& [directory, statistics]: directories) result[directory] = sorted(statistics);
+
+	return result;
+}
+
+// outcome: every labeled image keyed by its directory and id in name order, with its labels in description order
+map<pair<string, string>, vector<pair<string, LabelStats>>> LabelStore::image_snapshot() const
+{
+	map<pair<string, string>, vector<pair<string, LabelStats>>> result;
+	lock_guard<mutex> lock(directory_mutex);
+
+	for (const auto& [image, statistics]: images) result[image] = sorted(statistics);
+
+	return result;
+}
+
+// outcome: directories, their images and their statistics dropped, interned ids are kept
+void LabelStore::clear()
+{
+	lock_guard<mutex> lock(directory_mutex);
+	directories.clear();
+	images.clear();
+}
+
+// outcome: number of distinct descriptions interned so far
+size_t LabelStore::size() const
+{
+	shared_lock<shared_mutex> lock(intern_mutex);
+	return descriptions.size();
+}
+
+// forward only reader over a utf-8 json document, just enough to pull labels out of annotate responses
+//	strings without escapes are returned as views into the document, nothing else is copied
+class JsonReader
+{
+public:
+	JsonReader(string_view text) : p(text.data()), end(text.data() + text.size()) {}
+
+	// outcome: skips whitespace, returns whether the next character is c and consumes it
+	bool consume(char c)
+	{
+		skip_whitespace();
+		if (p < end && *p == c)
+		{
+			p++;
+			return true;
+		}
+		return false;
+	}
+
+	// outcome: returns whether the next character is c without consuming it
+	bool peek(char c)
+	{
+		skip_whitespace();
+		return p < end && *p == c;
+	}
+
+	// outcome: returns whether a number comes next
+	bool peek_number()
+	{
+		skip_whitespace();
+		return p < end && (*p == '-' || (*p >= '0' && *p <= '9'));
+	}
+
+	// outcome: reads a string, value views the document or buffer when escapes had to be decoded
+	bool read_string(string_view& value, string& buffer)
+	{
+		if (!consume('"')) return false;
+
+		const char* start = p;
+		while (p < end && *p != '"' && *p != '\\') p++;
+		if (p >= end) return false;
+
+		if (*p == '"')
+		{
+			value = string_view(start, p - start);
+			p++;
+			return true;
+		}
+
+		// escaped strings are rare in responses and decoded into buffer
+		buffer.assign(start, p);
+		while (p < end && *p != '"')
+		{
+			if (*p != '\\')
+			{
+				buffer += *p++;
+				continue;
+			}
+			if (++p >= end) return false;
+
+			switch (*p++)
+			{
+			case '"': buffer += '"'; break;
+			case '\\': buffer += '\\'; break;
+			case '/': buffer += '/'; break;
+			case 'b': buffer += '\b'; break;
+			case 'f': buffer += '\f'; break;
+			case 'n': buffer += '\n'; break;
+			case 'r': buffer += '\r'; break;
+			case 't': buffer += '\t'; break;
+			case 'u':
+			{
+				uint32_t code;
+				if (!read_hex(code)) return false;
+
+				// a high surrogate is combined with the low surrogate escape that follows it
+				if (code >= 0xD800 && code <= 0xDBFF && end - p >= 2 && p[0] == '\\' && p[1] == 'u')
+				{
+					uint32_t low;
+					p += 2;
+					if (!read_hex(low)) return false;
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				append_utf8(code, buffer);
+				break;
+			}
+			default: return false;
+			}
+		}
+		if (p >= end) return false;
+
+		p++;
+		value = buffer;
+		return true;
+	}
+
+	// outcome: reads a number
+	bool read_number(double& value)
+	{
+		skip_whitespace();
+
+		char* stop = nullptr;
+		const size_t length = min<size_t>(end - p, 63);
+		char digits[64];
+
+		// strtod needs a terminated string, numbers are short so only their prefix is copied
+		copy(p, p + length, digits);
+		digits[length] = '\0';
+		value = strtod(digits, &stop);
+		if (stop == digits) return false;
+
+		p += stop - digits;
+		return true;
+	}
+
+	// outcome: skips any value, nested objects and arrays included
+	bool skip_value()
+	{
+		string buffer;
+		string_view text;
+		double number;
+
+		skip_whitespace();
+		if (p >= end) return false;
+
+		switch (*p)
+		{
+		case '"': return read_string(text, buffer);
+		case '{':
+		case '[':
+		{
+			const char close = *p == '{' ? '}' : ']';
+			const bool object = *p == '{';
+			p++;
+
+			if (consume(close)) return true;
+			do
+			{
+				if (object && (!read_string(text, buffer) || !consume(':'))) return false;
+				if (!skip_value()) return false;
+			} while (consume(','));
+
+			return consume(close);
+		}
+		case 't': return literal("true");
+		case 'f': return literal("false");
+		case 'n': return literal("null");
+		default: return read_number(number);
+		}
+	}
+
+private:
+	void skip_whitespace()
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+	}
+
+	bool literal(string_view word)
+	{
+		if (static_cast<size_t>(end - p) < word.size() || string_view(p, word.size()) != word) return false;
+		p += word.size();
+		return true;
+	}
+
+	bool read_hex(uint32_t& code)
+	{
+		if (end - p < 4) return false;
+
+		code = 0;
+		for (int i = 0; i < 4; i++, p++)
+		{
+			code <<= 4;
+			if (*p >= '0' && *p <= '9') code |= *p - '0';
+			else if (*p >= 'a' && *p <= 'f') code |= *p - 'a' + 10;
+			else if (*p >= 'A' && *p <= 'F') code |= *p - 'A' + 10;
+			else return false;
+		}
+		return true;
+	}
+
+	static void append_utf8(uint32_t code, string& buffer)
+	{
+		if (code < 0x80) buffer += static_cast<char>(code);
+		else if (code < 0x800)
+		{
+			buffer += static_cast<char>(0xC0 | (code >> 6));
+			buffer += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			buffer += static_cast<char>(0xE0 | (code >> 12));
+			buffer += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			buffer += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			buffer += static_cast<char>(0xF0 | (code >> 18));
+			buffer += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+			buffer += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			buffer += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+
+	const char* p;
+	const char* end;
+};
+
+// assumptions:
+//	reader: positioned on a label annotation object
+//	store: interns the description
+// outcome: returns the label, nullopt when the object is malformed or has no description
+static optional<ScoredLabel> read_annotation(JsonReader& reader, LabelStore& store, string& buffer, bool& valid)
+{
+	string_view key, description;
+	string key_buffer;
+	double score = 0, topicality = 0;
+	bool described = false;
+
+	valid = false;
+	if (!reader.consume('{')) return nullopt;
+
+	if (!reader.consume('}'))
+	{
+		do
+		{
+			if (!reader.read_string(key, key_buffer) || !reader.consume(':')) return nullopt;
+
+			if (key == "description" && reader.peek('"'))
+			{
+				if (!reader.read_string(description, buffer)) return nullopt;
+				described = true;
+			}
+			else if (key == "score" && reader.peek_number()) { if (!reader.read_number(score)) return nullopt; }
+			else if (key == "topicality" && reader.peek_number()) { if (!reader.read_number(topicality)) return nullopt; }
+			else if (!reader.skip_value()) return nullopt;
+		} while (reader.consume(','));
+
+		if (!reader.consume('}')) return nullopt;
+	}
+
+	valid = true;
+	if (!described) return nullopt;
+
+	return ScoredLabel{ store.intern(description), static_cast<float>(score), static_cast<float>(topicality) };
+}
+
+// assumptions:
+//	body: utf-8 annotate response body
+//	first, last: images the request held, [first, last) of image_labels
+//	store: interns the label descriptions
+// outcome: labels and scores of every response stored in image_labels in request order, read in place
+//	without building a json tree or converting to wide strings, images without a valid response stay empty,
+//	returns false when body is not valid json
+bool parse_responses(string_view body, size_t first, size_t last, vector<ImageLabels>& image_labels, LabelStore& store)
+{
+	JsonReader reader(body);
+	string_view key;
+	string key_buffer, buffer;
+	size_t index = first;
+
+	if (!reader.consume('{')) return false;
+	if (reader.consume('}')) return true;
+
+	do
+	{
+		if (!reader.read_string(key, key_buffer) || !reader.consume(':')) return false;
+
+		if (key != "responses")
+		{
+			if (!reader.skip_value()) return false;
+			continue;
+		}
+
+		// responses come back in request order, one per image of the batch
+		if (!reader.consume('[')) return false;
+		if (reader.consume(']')) continue;
+
+		do
+		{
+			vector<ScoredLabel> labels;
+			bool failed = false;
+
+			if (!reader.consume('{')) return false;
+			if (!reader.consume('}'))
+			{
+				do
+				{
+					if (!reader.read_string(key, key_buffer) || !reader.consume(':')) return false;
+
+					// an image the api failed on has no labels, not an empty set of them
+					if (key == "error")
+					{
+						failed = true;
+						if (!reader.skip_value()) return false;
+					}
+					else if (key == "labelAnnotations" && reader.consume('['))
+					{
+						if (reader.consume(']')) continue;
+						do
+						{
+							bool valid;
+							auto label = read_annotation(reader, store, buffer, valid);
+							if (!valid) return false;
+							if (label) labels.push_back(*label);
+						} while (reader.consume(','));
+						if (!reader.consume(']')) return false;
+					}
+					else if (!reader.skip_value()) return false;
+				} while (reader.consume(','));
+
+				if (!reader.consume('}')) return false;
+			}
+
+			if (index < last && !failed) image_labels[index] = move(labels);
+			index++;
+		} while (reader.consume(','));
+
+		if (!reader.consume(']')) return false;
+	} while (reader.consume(','));
+
+	return reader.consume('}');
+}
@@ -0,0 +1,99 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// label of one image as answered by the vision api, the description is interned in a LabelStore
+struct ScoredLabel
+{
+	uint32_t id;
+	float score;
+	float topicality;
+};
+
+// labels of one image, empty when the api failed on it
+using ImageLabels = std::optional<std::vector<ScoredLabel>>;
+
+// statistics of one label across the labeled images of a directory
+struct LabelStats
+{
+	float max_score = 0;
+	double score_sum = 0;
+	uint32_t count = 0;
+
+	double mean_score() const { return count > 0 ? score_sum / count : 0; }
+};
+
+// interned label descriptions, the label statistics of every directory and the labels of every image in it
+//	interning and merging are safe from any thread, responses are merged as they complete
+//	ids stay valid for the lifetime of the store, clear only drops the directories and their images
+class LabelStore
+{
+public:
+	LabelStore() = default;
+
+	LabelStore(const LabelStore&) = delete;
+	LabelStore& operator=(const LabelStore&) = delete;
+
+	// outcome: returns the id of description, assigned on first use
+	uint32_t intern(std::string_view description);
+
+	// assumptions: id: returned by intern of this store
+	// outcome: returns the description of id
+	const std::string& description(uint32_t id) const;
+
+	// outcome: directory is reported even when none of its images get labels
+	void add_directory(const std::string& directory);
+
+	// assumptions: image: id of the image within directory, ex the segment name
+	// outcome: labels of image counted towards the statistics of directory and kept as the labels of image
+	void merge(const std::string& directory, const std::string& image, const std::vector<ScoredLabel>& labels);
+
+	// outcome: every directory in name order with its labels in description order
+	std::map<std::string, std::vector<std::pair<std::string, LabelStats>>> snapshot() const;
+
+	// outcome: every labeled image keyed by its directory and id in name order, with its labels in description order
+	std::map<std::pair<std::string, std::string>, std::vector<std::pair<std::string, LabelStats>>> image_snapshot() const;
+
+	// outcome: directories and their statistics dropped, interned ids are kept
+	void clear();
+
+	// outcome: number of distinct descriptions interned so far
+	size_t size() const;
+
+private:
+	std::vector<std::pair<std::string, LabelStats>> sorted(const std::unordered_map<uint32_t, LabelStats>& statistics) const;
+
+	// descriptions never move once interned, so the views keying ids stay valid
+	std::deque<std::string> descriptions;
+	std::unordered_map<std::string_view, uint32_t> ids;
+	mutable std::shared_mutex intern_mutex;
+
+	std::map<std::string, std::unordered_map<uint32_t, LabelStats>> directories;
+	std::map<std::pair<std::string, std::string>, std::unordered_map<uint32_t, LabelStats>> images;
+	mutable std::mutex directory_mutex;
+};
+
+// assumptions:
+//	body: utf-8 annotate response body
+//	first, last: images the request held, [first, last) of image_labels
+//	store: interns the label descriptions
+// outcome: labels and scores of every response stored in image_labels in request order, read in place
+//	without building a json tree or converting to wide strings, images without a valid response stay empty,
+//	returns false when body is not valid json
+bool parse_responses(std::string_view body, size_t first, size_t last, std::vector<ImageLabels>& image_labels,
+	LabelStore& store);
@@ -0,0 +1,177 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// custom
+#include "label_cache.h"
+#include "manifest.h"
+
+// namespaces
+using namespace std;
+
+// global constants
+const string MANIFEST_HEADER = "# segmentation-context stage manifest 1";
+
+// assumptions: path: readable file
+// outcome: returns true and stores the hash64 of the file contents in hash, bytes holds the contents when given
+bool file_hash(const string& path, uint64_t& hash, vector<unsigned char>* bytes)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file) return false;
+
+	vector<unsigned char> contents(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	if (!contents.empty() && !file.read(reinterpret_cast<char*>(contents.data()), contents.size())) return false;
+
+	hash = hash64(contents.data(), contents.size());
+	if (bytes) *bytes = move(contents);
+
+	return true;
+}
+
+// assumptions: path: manifest file, created when missing
+// outcome: manifest holds the records stored in path
+StageManifest::StageManifest(const string& path)
+	: path(path)
+{
+	error_code error;
+	const filesystem::path parent = filesystem::path(path).parent_path();
+	if (!parent.empty()) filesystem::create_directories(parent, error);
+
+	// a truncated, stale or foreign file is rewritten before it is appended to
+	if (!load() || lines > 2 * records.size()) compact();
+	else log.open(path, ios::app);
+}
+
+// outcome: returns whether stage of image completed for the same input hash and parameters
+//	and every one of its outputs still exists, counts a skip when it did
+bool StageManifest::complete(const string& image, const string& stage, uint64_t input, const string& parameters)
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	auto found = records.find({ image, stage });
+	if (found == records.end() || found->second.input != input || found->second.parameters != parameters) return false;
+
+	for (const auto& output: found->second.outputs)
+		if (!filesystem::exists(output)) return false;
+
+	skip_count++;
+	return true;
+}
+
+// outcome: returns the outputs recorded for stage of image, empty when there are none
+vector<string> StageManifest::outputs(const string& image, const string& stage) const
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	auto found = records.find({ image, stage });
+	return found == records.end() ? vector<string>() : found->second.outputs;
+}
+
+// assumptions: outputs: files written by the stage, already on disk
+// outcome: stage of image recorded as complete and appended to the manifest file
+void StageManifest::record(const string& image, const string& stage, uint64_t input, const string& parameters,
+	const vector<string>& outputs)
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	Record& record = records[{ image, stage }];
+	record = { input, parameters, outputs };
+	append(image, stage, record);
+}
+
+// outcome: manifest file rewritten with only the live records
+void StageManifest::compact()
+{
+	lock_guard<std::mutex> lock(mutex);
+
+	if (log.is_open()) log.close();
+
+	// written next to the manifest and swapped in so an interrupted compaction keeps the old file
+	const string temporary = path + ".tmp";
+	log.open(temporary, ios::trunc);
+	log << MANIFEST_HEADER << '\n';
+
+	lines = 0;
+	for (const auto& [key, record]: records) append(key.first, key.second, record);
+	log.close();
+
+	error_code error;
+	filesystem::rename(temporary, path, error);
+	if (error) printf("manifest compaction failure:%s\n", error.message().c_str());
+
+	log.open(path, ios::app);
+}
+
+size_t StageManifest::skipped() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return skip_count;
+}
+
+size_t StageManifest::size() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return records.size();
+}
+
+// outcome: records replayed from the manifest file, a truncated final line is dropped,
+//	returns false when the file is missing, of another format or truncated
+bool StageManifest::load()
+{
+	ifstream file(path);
+	string line;
+
+	if (!getline(file, line)) return false;
+	if (line != MANIFEST_HEADER)
+	{
+		printf("manifest format mismatch:%s\n", path.c_str());
+		return false;
+	}
+
+	while (getline(file, line))
+	{
+		// an interrupted append leaves a final line without its end marker or newline
+		if (file.eof()) return false;
+		if (line.empty() || line.back() != '\t') continue;
+
+		vector<string> fields;
+		size_t start = 0;
+		for (size_t tab = line.find('\t'); tab != string::npos; start = tab + 1, tab = line.find('\t', start))
+			fields.push_back(line.substr(start, tab - start));
+
+		if (fields.size() < 4) continue;
+
+		Record record{ strtoull(fields[2].c_str(), nullptr, 16), fields[3], vector<string>(fields.begin() + 4, fields.end()) };
+		records[{ fields[0], fields[1] }] = move(record);
+		lines++;
+	}
+
+	return true;
+}
+
+// outcome: record written as one line at the end of the manifest file, every field ends with a tab
+void StageManifest::append(const string& image, const string& stage, const Record& record)
+{
+	if (!log.is_open()) return;
+
+	char input[17];
+	snprintf(input, sizeof(input), "%016llx", static_cast<unsigned long long>(record.input));
+
+	log << image << '\t' << stage << '\t' << input << '\t' << record.parameters << '\t';
+	for (const auto& output: record.outputs) log << output << '\t';
+	log << '\n';
+	log.flush();
+
+	lines++;
+}
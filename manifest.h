@@ -0,0 +1,73 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// assumptions: path: readable file
+// outcome: returns true and stores the hash64 of the file contents in hash, bytes holds the contents when given
+bool file_hash(const std::string& path, uint64_t& hash, std::vector<unsigned char>* bytes = nullptr);
+
+// record of the completed stages of every image, so reruns skip the work whose inputs did not change
+//	file: append only text log, one tab separated record per line of image, stage, input hash, parameters
+//		and output paths, the last record of an image and stage wins, compacted once it holds twice as many
+//		records as live ones
+//	a stage is only recorded after its outputs are on disk, so an interrupted run resumes at the first
+//		stage that did not finish
+class StageManifest
+{
+public:
+	// assumptions: path: manifest file, created when missing
+	// outcome: manifest holds the records stored in path
+	StageManifest(const std::string& path);
+
+	StageManifest(const StageManifest&) = delete;
+	StageManifest& operator=(const StageManifest&) = delete;
+
+	// outcome: returns whether stage of image completed for the same input hash and parameters
+	//	and every one of its outputs still exists, counts a skip when it did
+	bool complete(const std::string& image, const std::string& stage, uint64_t input, const std::string& parameters);
+
+	// outcome: returns the outputs recorded for stage of image, empty when there are none
+	std::vector<std::string> outputs(const std::string& image, const std::string& stage) const;
+
+	// assumptions: outputs: files written by the stage, already on disk
+	// outcome: stage of image recorded as complete and appended to the manifest file
+	void record(const std::string& image, const std::string& stage, uint64_t input, const std::string& parameters,
+		const std::vector<std::string>& outputs);
+
+	// outcome: manifest file rewritten with only the live records
+	void compact();
+
+	size_t skipped() const;
+	size_t size() const;
+
+private:
+	struct Record
+	{
+		uint64_t input;
+		std::string parameters;
+		std::vector<std::string> outputs;
+	};
+
+	bool load();
+	void append(const std::string& image, const std::string& stage, const Record& record);
+
+	std::string path;
+	size_t lines = 0;
+	size_t skip_count = 0;
+
+	// keyed by image and stage
+	std::map<std::pair<std::string, std::string>, Record> records;
+	std::ofstream log;
+	mutable std::mutex mutex;
+};
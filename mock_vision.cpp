@@ -0,0 +1,117 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+// vcpkg
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+// custom
+#include "mock_vision.h"
+
+// namespaces
+using namespace std;
+using namespace web;
+
+// global constants
+const wstring MOCK_LABELS[] = { L"Flower", L"Petal", L"Plant", L"Sky", L"Tree", L"Grass", L"Water", L"Cloud" };
+const size_t MOCK_LABEL_COUNT = sizeof(MOCK_LABELS) / sizeof(MOCK_LABELS[0]);
+const size_t MOCK_LABELS_PER_IMAGE = 3;
+const http::status_code TOO_MANY_REQUESTS = 429;
+
+// assumptions:
+//	uri: http address to listen on, ex http://localhost:8080/
+//	latency: delay added before every reply
+//	fault_rate: share of requests in [0, 1] answered with 429 or 503 instead of labels
+// outcome: server is listening on uri
+MockVisionServer::MockVisionServer(const wstring& uri, chrono::milliseconds latency, double fault_rate)
+	: listener(web::uri(uri)), latency(latency), fault_rate(fault_rate)
+{
+	listener.support(http::methods::POST, [this](http::http_request request) { handle(request); });
+	listener.open().wait();
+}
+
+// outcome: server stopped listening
+MockVisionServer::~MockVisionServer()
+{
+	try { listener.close().wait(); }
+	catch (const exception& e) { printf("mock close exception:%s\n", e.what()); }
+}
+
+// outcome: number of requests answered so far
+size_t MockVisionServer::served() const
+{
+	return count.load();
+}
+
+// outcome: number of requests rejected by fault injection so far
+size_t MockVisionServer::faults() const
+{
+	return fault_count.load();
+}
+
+// assumptions: request: body follows the images:annotate request json schema
+// outcome: replies with one response per annotate request, images without content get an empty response
+void MockVisionServer::handle(http::http_request request)
+{
+	// the golden ratio sequence spreads the rejected requests evenly and repeatably over the run
+	const size_t sequence = received++;
+	if (fmod(sequence * 0.6180339887498949, 1.0) < fault_rate)
+	{
+		this_thread::sleep_for(latency);
+		fault_count++;
+		request.reply(sequence % 2 == 0 ? TOO_MANY_REQUESTS : http::status_codes::ServiceUnavailable);
+		return;
+	}
+
+	request.extract_json().then([this, request](pplx::task<json::value> previous)
+	{
+		json::value reply = json::value::object();
+		reply[L"responses"] = json::value::array();
+
+		try
+		{
+			json::value body = previous.get();
+			size_t index = 0;
+
+			for (auto& annotate: body[L"requests"].as_array())
+			{
+				json::value response = json::value::object();
+				const wstring& content = annotate[L"image"][L"content"].as_string();
+
+				if (!content.empty())
+				{
+					const size_t seed = hash<wstring>()(content);
+					response[L"labelAnnotations"] = json::value::array();
+
+					for (size_t i = 0; i < MOCK_LABELS_PER_IMAGE; i++)
+					{
+						json::value label = json::value::object();
+						label[L"description"] = json::value::string(MOCK_LABELS[(seed + i * 3) % MOCK_LABEL_COUNT]);
+						label[L"score"] = json::value::number(0.9 - 0.1 * i);
+						label[L"topicality"] = json::value::number(0.9 - 0.1 * i);
+						response[L"labelAnnotations"][i] = label;
+					}
+				}
+				reply[L"responses"][index++] = response;
+			}
+		}
+		catch (const exception& e)
+		{
+			request.reply(http::status_codes::BadRequest, json::value::string(utility::conversions::to_string_t(e.what())));
+			return;
+		}
+
+		this_thread::sleep_for(latency);
+		count++;
+		request.reply(http::status_codes::OK, reply);
+	});
+}
@@ -0,0 +1,46 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// vcpkg
+#include <cpprest/http_listener.h>
+
+// local stand in for the vision api images:annotate endpoint so labeling can be tested and
+// benchmarked offline, every image gets a few labels picked from a fixed vocabulary by its content,
+// a share of the requests can be rejected like a throttled or failing endpoint would
+class MockVisionServer
+{
+public:
+	// assumptions:
+	//	uri: http address to listen on, ex http://localhost:8080/
+	//	latency: delay added before every reply
+	//	fault_rate: share of requests in [0, 1] answered with 429 or 503 instead of labels
+	// outcome: server is listening on uri
+	MockVisionServer(const std::wstring& uri, std::chrono::milliseconds latency, double fault_rate = 0);
+
+	// outcome: server stopped listening
+	~MockVisionServer();
+
+	// outcome: number of requests answered so far
+	size_t served() const;
+
+	// outcome: number of requests rejected by fault injection so far
+	size_t faults() const;
+
+private:
+	void handle(web::http::http_request request);
+
+	web::http::experimental::listener::http_listener listener;
+	std::chrono::milliseconds latency;
+	double fault_rate;
+	std::atomic<size_t> count{ 0 };
+	std::atomic<size_t> received{ 0 };
+	std::atomic<size_t> fault_count{ 0 };
+};
@@ -0,0 +1,95 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+
+// custom
+#include "options.h"
+
+// namespaces
+using namespace std;
+
+// assumptions:
+//	argv[first, argc): optional arguments of the form --name=value
+//	options: properly initialized options
+// outcome: options holds every recognized argument, anything else is reported and ignored
+void parse_options(int argc, char** argv, int first, Options& options)
+{
+	for (int i = first; i < argc; i++)
+	{
+		const string argument(argv[i]);
+		const size_t split = argument.find('=');
+		const string name = argument.substr(0, split);
+		const string value = split == string::npos ? string() : argument.substr(split + 1);
+
+		try
+		{
+			if (name == "--engine" && value == "opencv") options.engine = KMeansEngine::OPENCV;
+			else if (name == "--engine" && value == "pixel") options.engine = KMeansEngine::PIXEL;
+			else if (name == "--engine" && value == "histogram") options.engine = KMeansEngine::HISTOGRAM;
+			else if (name == "--engine" && value == "slic") options.engine = KMeansEngine::SLIC;
+			else if (name == "--histogram-bits") options.histogram_bits = stoi(value);
+			else if (name == "--slic-superpixels") options.slic_superpixels = stoi(value);
+			else if (name == "--slic-compactness") options.slic_compactness = stod(value);
+			else if (name == "--slic-iterations") options.slic_iterations = stoi(value);
+			else if (name == "--sweep")
+			{
+				const size_t dash = value.find('-');
+				options.sweep_first = stoi(value.substr(0, dash));
+				options.sweep_last = dash == string::npos ? options.sweep_first : stoi(value.substr(dash + 1));
+				if (options.sweep_first < 1 || options.sweep_last < options.sweep_first) throw invalid_argument(value);
+			}
+			else if (name == "--seeding" && value == "random") options.kmeans.seeding = KMeansSeeding::RANDOM;
+			else if (name == "--seeding" && value == "plus-plus") options.kmeans.seeding = KMeansSeeding::PLUS_PLUS;
+			else if (name == "--batch-size") options.kmeans.batch_size = stoi(value);
+			else if (name == "--windows") options.windows = value;
+			else if (name == "--grabcut" && value == "full") options.grabcut = GrabCutMode::FULL;
+			else if (name == "--grabcut" && value == "pyramid") options.grabcut = GrabCutMode::PYRAMID;
+			else if (name == "--grabcut" && value == "seeded") options.grabcut = GrabCutMode::SEEDED;
+			else if (name == "--grabcut-edge") options.grabcut_edge = stoi(value);
+			else if (name == "--grabcut-threads") options.grabcut_threads = stoul(value);
+			else if (name == "--in-memory") options.in_memory = true;
+			else if (name == "--write-segments") options.write_segments = stoi(value) != 0;
+			else if (name == "--output-codec" && (value == "jpg" || value == "png" || value == "webp")) options.output_codec = "." + value;
+			else if (name == "--output-quality") options.output_quality = stoi(value);
+			else if (name == "--output-threads") options.output_threads = stoul(value);
+			else if (name == "--output-queue") options.output_queue = stoul(value);
+			else if (name == "--upload-crop") options.upload_crop = stoi(value) != 0;
+			else if (name == "--upload-edge") options.upload_edge = stoi(value);
+			else if (name == "--upload-bytes") options.upload_bytes = stoul(value);
+			else if (name == "--upload-base") options.upload_base = stoi(value) != 0;
+			else if (name == "--endpoint") options.endpoint = value;
+			else if (name == "--request-window") options.request_window = stoul(value);
+			else if (name == "--request-rate") options.request_rate = stod(value);
+			else if (name == "--request-burst") options.request_burst = stoul(value);
+			else if (name == "--request-timeout") options.request_timeout = stoi(value);
+			else if (name == "--request-attempts") options.request_attempts = stoi(value);
+			else if (name == "--batch-images") options.batch_images = stoul(value);
+			else if (name == "--max-body-bytes") options.max_body_bytes = stoul(value);
+			else if (name == "--mock") options.mock = true;
+			else if (name == "--mock-port") options.mock_port = stoi(value);
+			else if (name == "--mock-latency") options.mock_latency = stoi(value);
+			else if (name == "--mock-fault-rate") options.mock_fault_rate = stod(value);
+			else if (name == "--cache") options.cache = value;
+			else if (name == "--cache-entries") options.cache_entries = stoul(value);
+			else if (name == "--stage-manifest") options.stage_manifest = value;
+			else if (name == "--label-index") options.label_index = value;
+			else if (name == "--json-labels") options.json_labels = value.empty() || stoi(value) != 0;
+			else if (name == "--query-label") options.query_label = value;
+			else if (name == "--query-image") options.query_image = value;
+			else if (name == "--trace") options.trace = value;
+			else if (name == "--serve") options.serve = value;
+			else if (name == "--tile-rows") options.tile_rows = stoi(value);
+			else if (name == "--tile-sample") options.tile_sample = stoul(value);
+			else if (name == "--batch") options.batch = true;
+			else if (name == "--batch-threads") options.batch_threads = stoul(value);
+			else if (name == "--batch-queue") options.batch_queue = stoul(value);
+			else printf("unknown option:%s\n", argument.c_str());
+		}
+		catch (const exception&) { printf("invalid option:%s\n", argument.c_str()); }
+	}
+}
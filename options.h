@@ -0,0 +1,136 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <string>
+
+// custom
+#include "pixel_kmeans.h"
+
+// clustering engine used by segmentation, slic merges spatially connected superpixels instead of clustering colors
+enum class KMeansEngine { OPENCV, PIXEL, HISTOGRAM, SLIC };
+
+// grabcut of every window, see grabcut_window
+enum class GrabCutMode { FULL, PYRAMID, SEEDED };
+
+struct Options
+{
+	KMeansEngine engine = KMeansEngine::OPENCV;
+	KMeansOptions kmeans;
+
+	// cluster sizes segmented in one warm started sweep, 0 segments the single cluster size argument
+	int sweep_first = 0;
+	int sweep_last = 0;
+
+	// bits kept per channel by the histogram engine, 2^(3 * bits) bins at most
+	int histogram_bits = 5;
+
+	// superpixels the slic engine starts from before merging them down to the cluster size, the weight of
+	// their spatial distance against the color distance and the passes refining them
+	int slic_superpixels = 400;
+	double slic_compactness = 20;
+	int slic_iterations = 10;
+
+	// grabcut windows, see window_layout
+	std::string windows = "quadrants,center";
+
+	// upper bound of concurrent grabcuts, 0 uses one per hardware thread
+	size_t grabcut_threads = 0;
+
+	// full resolution, coarse to fine or kmeans seeded grabcut, the pyramid mode solves windows scaled
+	// to grabcut_edge pixels on their longer side first
+	GrabCutMode grabcut = GrabCutMode::FULL;
+	int grabcut_edge = 256;
+
+	// label this run's segments from memory instead of reading the segments directory back,
+	// write_segments keeps the segment jpegs on disk as a side output
+	bool in_memory = false;
+	bool write_segments = true;
+
+	// codec and quality of written segment images, see OutputSink, and the writer threads and
+	// files they may fall behind by before the pipeline waits on them
+	std::string output_codec = ".jpg";
+	int output_quality = 95;
+	size_t output_threads = 2;
+	size_t output_queue = 64;
+
+	// segments are uploaded cropped to their non-black pixels when upload_crop is set, scaled down to upload_edge
+	// pixels on their longer side and encoded with the codec and quality that fit in upload_bytes, 0 disables
+	// the edge and the budget, the files written to disk keep the full segment, base images are only prepared
+	// the same way when upload_base is set and are otherwise sent as the default jpeg of the whole photo
+	bool upload_crop = true;
+	int upload_edge = 640;
+	size_t upload_bytes = 64 << 10;
+	bool upload_base = false;
+
+	// vision api base address and upper bound of annotate requests kept in flight, the actual limit
+	// adapts to throttling below it
+	std::string endpoint = "https://vision.googleapis.com/";
+	size_t request_window = 8;
+
+	// requests per second and burst the token bucket lets through, 0 leaves the rate unlimited
+	double request_rate = 0;
+	size_t request_burst = 4;
+
+	// deadline of one annotate attempt in ms and attempts per request before its images are given up on
+	int request_timeout = 30000;
+	int request_attempts = 5;
+
+	// images packed into one annotate request and the request body size it must stay under
+	size_t batch_images = 16;
+	size_t max_body_bytes = 8 << 20;
+
+	// serve annotate requests from a local mock endpoint on mock_port, each reply delayed by mock_latency ms,
+	// mock_fault_rate of the requests are answered with 429 or 503 instead
+	bool mock = false;
+	int mock_port = 8080;
+	int mock_latency = 0;
+	double mock_fault_rate = 0;
+
+	// label cache file consulted before any annotate request, empty disables it,
+	// cache_entries bounds the images it remembers
+	std::string cache = "output/labels.cache";
+	size_t cache_entries = 100000;
+
+	// record of the completed stages of every image, reruns skip the stages whose inputs and settings
+	// did not change, empty disables it
+	std::string stage_manifest = "output/stages.tsv";
+
+	// binary label index every run appends its labels to, empty disables it, json_labels also writes
+	// the per directory json files
+	std::string label_index = "output/labels.index";
+	bool json_labels = false;
+
+	// look up the directories carrying query_label or the labels of directory query_image in the label index
+	// and exit
+	std::string query_label;
+	std::string query_image;
+
+	// chrome trace event file the timed stages are written to, with a summary table printed at exit,
+	// empty leaves tracing off
+	std::string trace;
+
+	// http address the service listens on for jobs, empty runs the image or batch given on the command line
+	std::string serve;
+
+	// segment in bands of tile_rows rows with centers fitted on tile_sample pixels, so memory stays
+	// bounded for very large images, 0 segments the whole image at once
+	int tile_rows = 0;
+	size_t tile_sample = 1 << 18;
+
+	// treat the image argument as a directory or manifest of images, batch_threads sizes the
+	// work-stealing pool (0 uses one per hardware thread) and batch_queue bounds the encoded images
+	// waiting for labeling (0 uses two per worker)
+	bool batch = false;
+	size_t batch_threads = 0;
+	size_t batch_queue = 0;
+};
+
+// assumptions:
+//	argv[first, argc): optional arguments of the form --name=value
+//	options: properly initialized options
+// outcome: options holds every recognized argument, anything else is reported and ignored
+void parse_options(int argc, char** argv, int first, Options& options);
@@ -0,0 +1,157 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// custom
+#include "output_sink.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+const int DEFAULT_JPEG_QUALITY = 95;
+
+// assumptions:
+//	threads: number of writer threads, at least 1
+//	capacity: files waiting in the queue before writes block
+//	codec: image extension, .jpg, .png or .webp
+//	quality: jpeg and webp quality in [0, 100], png compression level in [0, 9]
+OutputSink::OutputSink(size_t threads, size_t capacity, const string& codec, int quality)
+	: codec(codec), queue(capacity)
+{
+	if (codec == ".png") parameters = { IMWRITE_PNG_COMPRESSION, min(max(quality, 0), 9) };
+	else if (codec == ".webp") parameters = { IMWRITE_WEBP_QUALITY, min(max(quality, 1), 100) };
+	else parameters = { IMWRITE_JPEG_QUALITY, min(max(quality, 0), 100) };
+
+	for (size_t i = 0; i < max<size_t>(threads, 1); i++) writers.emplace_back(&OutputSink::work, this);
+}
+
+// outcome: waits for queued files to be written and joins the writers
+OutputSink::~OutputSink()
+{
+	queue.close();
+	for (auto& writer: writers) writer.join();
+}
+
+// outcome: bytes are written to path in the background, missing directories are created
+void OutputSink::write(const string& path, vector<uchar> bytes)
+{
+	submit({ path, move(bytes), Mat() });
+}
+
+void OutputSink::write(const string& path, const string& text)
+{
+	submit({ path, vector<uchar>(text.begin(), text.end()), Mat() });
+}
+
+// assumptions: image: not modified by the caller afterwards, the sink keeps a reference to it
+// outcome: image is encoded with the sink codec and written to path plus extension() in the background
+void OutputSink::write_image(const string& path, const Mat& image)
+{
+	submit({ path + codec, vector<uchar>(), image });
+}
+
+// outcome: returns once every file handed to the sink before the call is written
+void OutputSink::flush()
+{
+	unique_lock<std::mutex> lock(mutex);
+	const uint64_t target = submitted;
+	written.wait(lock, [&]() { return finished >= target; });
+}
+
+// assumptions: paths: files handed to the sink, images with their extension
+// outcome: returns once none of paths is waiting to be written, files of other callers are not waited for
+void OutputSink::flush(const vector<string>& paths)
+{
+	unique_lock<std::mutex> lock(mutex);
+	written.wait(lock, [&]() { return none_of(paths.begin(), paths.end(), [&](const string& path) { return pending.count(path); }); });
+}
+
+// outcome: extension of the images the sink encodes, ex .jpg
+const string& OutputSink::extension() const
+{
+	return codec;
+}
+
+// outcome: whether images are encoded exactly like imencode(".jpg") with default parameters,
+//	so bytes already encoded that way can be written as they are
+bool OutputSink::default_jpeg() const
+{
+	return codec == ".jpg" && parameters[1] == DEFAULT_JPEG_QUALITY;
+}
+
+// outcome: number of files that could not be encoded or written
+size_t OutputSink::failures() const
+{
+	lock_guard<std::mutex> lock(mutex);
+	return failed;
+}
+
+// outcome: job counted and queued, blocks while the queue is full
+void OutputSink::submit(Job job)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		submitted++;
+		pending[job.path]++;
+	}
+	queue.push(move(job));
+}
+
+// outcome: encodes and writes queued jobs until the sink is closed and drained
+void OutputSink::work()
+{
+	Job job;
+
+	while (queue.pop(job))
+	{
+		bool success = true;
+
+		if (!job.image.empty())
+		{
+			TraceScope trace("imencode", job.image.total() * job.image.elemSize());
+			success = imencode(codec, job.image, job.bytes, parameters);
+			trace.bytes_out(job.bytes.size());
+			job.image.release();
+			if (!success) printf("conversion failure:%s\n", job.path.c_str());
+		}
+
+		if (success)
+		{
+			TraceScope trace("write_file", job.bytes.size());
+			error_code error;
+			const filesystem::path parent = filesystem::path(job.path).parent_path();
+			if (!parent.empty()) filesystem::create_directories(parent, error);
+
+			ofstream file(job.path, ios::binary);
+			file.write(reinterpret_cast<const char*>(job.bytes.data()), job.bytes.size());
+
+			success = static_cast<bool>(file);
+			if (success) trace.bytes_out(job.bytes.size());
+			if (!success) printf("write failure:%s\n", job.path.c_str());
+		}
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+			finished++;
+			if (!success) failed++;
+			if (--pending[job.path] == 0) pending.erase(job.path);
+		}
+		written.notify_all();
+	}
+}
@@ -0,0 +1,91 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "bounded_queue.h"
+
+// background writer for every file the pipeline produces
+//	encoding and file writes run on worker threads behind a bounded queue, so callers only block when
+//	the queue is full, flush waits until everything written so far is on disk
+class OutputSink
+{
+public:
+	// assumptions:
+	//	threads: number of writer threads, at least 1
+	//	capacity: files waiting in the queue before writes block
+	//	codec: image extension, .jpg, .png or .webp
+	//	quality: jpeg and webp quality in [0, 100], png compression level in [0, 9]
+	OutputSink(size_t threads, size_t capacity, const std::string& codec, int quality);
+
+	// outcome: waits for queued files to be written and joins the writers
+	~OutputSink();
+
+	OutputSink(const OutputSink&) = delete;
+	OutputSink& operator=(const OutputSink&) = delete;
+
+	// outcome: bytes are written to path in the background, missing directories are created
+	void write(const std::string& path, std::vector<uchar> bytes);
+	void write(const std::string& path, const std::string& text);
+
+	// assumptions: image: not modified by the caller afterwards, the sink keeps a reference to it
+	// outcome: image is encoded with the sink codec and written to path plus extension() in the background
+	void write_image(const std::string& path, const cv::Mat& image);
+
+	// outcome: returns once every file handed to the sink before the call is written
+	void flush();
+
+	// assumptions: paths: files handed to the sink, images with their extension
+	// outcome: returns once none of paths is waiting to be written, files of other callers are not waited for
+	void flush(const std::vector<std::string>& paths);
+
+	// outcome: extension of the images the sink encodes, ex .jpg
+	const std::string& extension() const;
+
+	// outcome: whether images are encoded exactly like imencode(".jpg") with default parameters,
+	//	so bytes already encoded that way can be written as they are
+	bool default_jpeg() const;
+
+	// outcome: number of files that could not be encoded or written
+	size_t failures() const;
+
+private:
+	struct Job
+	{
+		std::string path;
+		std::vector<uchar> bytes;
+		cv::Mat image;
+	};
+
+	void submit(Job job);
+	void work();
+
+	std::string codec;
+	std::vector<int> parameters;
+	BoundedQueue<Job> queue;
+	std::vector<std::thread> writers;
+
+	// submitted and finished files, flush waits for finished to catch up
+	mutable std::mutex mutex;
+	std::condition_variable written;
+	uint64_t submitted = 0;
+	uint64_t finished = 0;
+	size_t failed = 0;
+
+	// queued or in progress writes of every path
+	std::unordered_map<std::string, size_t> pending;
+};
@@ -0,0 +1,1082 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// codecvt deprecated in c++17 and up but std committee will not be removing codecvt for the 
+// foreseable future until a replacement is standardized
+// source: https://stackoverflow.com/questions/2573834/c-convert-string-or-char-to-wstring-or-wchar-t
+#define _SILENCE_CXX17_CODECVT_HEADER_DEPRECATION_WARNING
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <codecvt>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// vcpkg
+#include <cpprest/http_client.h>
+#include <cpprest/json.h>
+#include <cpprest/uri.h>
+
+// custom
+#include "base64.h"
+#include "histogram_kmeans.h"
+#include "label_cache.h"
+#include "label_index.h"
+#include "label_store.h"
+#include "options.h"
+#include "output_sink.h"
+#include "pipeline.h"
+#include "pixel_kmeans.h"
+#include "rate_control.h"
+#include "segments.h"
+#include "slic.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+using namespace web;
+
+// global constants
+const double EPSILON = 1.0;
+const int ATTEMPTS = 2;
+const int ITER = 10;
+
+// seed of the tiled mode sample and centers, fixed so every tile size produces the same output
+const uint64_t TILE_SEED = 0x5eed;
+
+// feature requested for every image, part of the label cache key
+const size_t MAX_RESULTS = 50;
+const string TYPE = "LABEL_DETECTION";
+const string MODEL = "builtin/latest";
+
+// quota exceeded status, not every cpprest version names it
+const http::status_code TOO_MANY_REQUESTS = 429;
+
+// global variables
+// one converter per thread, wstring_convert keeps conversion state and service jobs convert concurrently
+thread_local wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
+
+// outcome: returns the part of the segment names naming the engine, ex kmean in rose_kmean4_0
+static const char* segment_method(const Options& options)
+{
+	return options.engine == KMeansEngine::SLIC ? "slic" : "kmean";
+}
+
+// assumptions:
+//	input: valid image file loaded in opencv
+//  file_dir: correct directory of the image 
+//	cluster_size: integer values: [2-20]
+//	options: selects the kmeans engine and its settings
+//	segments: properly initialized vector
+//	pixel_labels, pixel_centers: nullptr or receive the CV_32S N x 1 labels and CV_32F K x 3 centers of the kmeans,
+//		so later stages can start from them
+// outcome: outputing the image into segments, appended to segments in memory
+void segmentation(Mat& input, const string& file_dir, const int& cluster_size, const Options& options, vector<Segment>& segments,
+	Mat* pixel_labels, Mat* pixel_centers) {
+	TraceScope trace("segmentation", input.total() * input.elemSize());
+
+	// do kmeans
+	Mat labels, centers;
+	int clusters = cluster_size;
+	TermCriteria criteria(TermCriteria::EPS + TermCriteria::MAX_ITER, ITER, EPSILON);
+	optional<TraceScope> trace_kmeans(in_place, options.engine == KMeansEngine::SLIC ? "slic" : "kmeans",
+		input.total() * input.elemSize());
+
+	// the histogram and slic engines read the 8 bit pixels directly, the others need one float row per pixel
+	if (options.engine == KMeansEngine::SLIC)
+	{
+		vector<Mat> merged_labels, merged_centers;
+		slic_clusters(input, { clusters }, options, merged_labels, merged_centers);
+		labels = merged_labels.front();
+		centers = merged_centers.front();
+	}
+	else if (options.engine == KMeansEngine::HISTOGRAM)
+	{
+		double quantization_error = 0;
+		const double compactness = histogram_kmeans(input, clusters, options.histogram_bits, criteria, ATTEMPTS, options.kmeans,
+			labels, centers, quantization_error);
+
+		// only worth reporting next to the timings of a traced run, service and batch jobs stay quiet
+		if (trace_enabled()) printf("histogram compactness:%.0f quantization error:%.0f\n", compactness, quantization_error);
+	}
+	else
+	{
+		// convert image pixel to float & reshape to a [3 x W*H] Mat 
+		//  (so every pixel is on a row of it's own)
+		Mat data;
+		input.convertTo(data, CV_32F);
+		data = data.reshape(1, static_cast<int>(data.total()));
+
+		if (options.engine == KMeansEngine::PIXEL)
+			pixel_kmeans<3>(data, clusters, labels, criteria, ATTEMPTS, options.kmeans, centers);
+		else
+			kmeans(data, clusters, labels, criteria, ATTEMPTS, KMEANS_RANDOM_CENTERS, centers);
+		data.release();
+	}
+	trace_kmeans.reset();
+
+	// split the image into one segment per cluster and the image of cluster centers in one pass
+	vector<Mat> clustered;
+	Mat img;
+	extract_segments(input, labels, centers, clustered, img);
+	trace.bytes_out((clusters + 1) * img.total() * img.elemSize());
+	if (pixel_labels) *pixel_labels = labels;
+	if (pixel_centers) *pixel_centers = centers.reshape(1, clusters);
+
+	//for each cluster, outputing the segments 
+	for (int center_id = 0; center_id < clusters; center_id++) {
+		segments.push_back({ file_dir, format("%s_%s%d_%d", file_dir.c_str(), segment_method(options), clusters, center_id),
+			clustered[center_id] });
+	}
+
+	//display the k mean result and output into the segment directory
+	//namedWindow("Original Image");
+	//imshow("Original Image", ocv);
+	segments.push_back({ file_dir, format("%s_%s%d_full", file_dir.c_str(), segment_method(options), clusters), img });
+}
+
+// assumptions:
+//	data: N x 3 CV_32F points, weights empty or one CV_32F weight per point
+//	labels: CV_32S N x 1 labels of data against centers
+//	centers: CV_32F K x 3 cluster centers
+// outcome: the cluster with the largest squared error is split in two along its channel of largest variance,
+//	centers gains row K and the points of the split cluster above its center move to label K
+void split_worst_cluster(const Mat& data, const Mat& weights, Mat& labels, Mat& centers)
+{
+	const int clusters = centers.rows;
+	const int count = data.rows;
+	const int stripes = max(getNumThreads(), 1);
+
+	// weight, channel sums and channel squared sums per cluster and stripe
+	vector<vector<double>> partials(stripes);
+
+	parallel_for_(Range(0, stripes), [&](const Range& range)
+	{
+		for (int stripe = range.start; stripe < range.end; stripe++)
+		{
+			vector<double>& moments = partials[stripe];
+			moments.assign(static_cast<size_t>(clusters) * 7, 0);
+
+			for (int i = static_cast<int>(static_cast<int64_t>(count) * stripe / stripes);
+				i < static_cast<int>(static_cast<int64_t>(count) * (stripe + 1) / stripes); i++)
+			{
+				const float* point = data.ptr<float>(i);
+				const double weight = weights.empty() ? 1.0 : weights.at<float>(i);
+				double* moment = moments.data() + static_cast<size_t>(labels.at<int>(i)) * 7;
+
+				moment[0] += weight;
+				for (int c = 0; c < 3; c++)
+				{
+					moment[1 + c] += weight * point[c];
+					moment[4 + c] += weight * point[c] * point[c];
+				}
+			}
+		}
+	}, stripes);
+
+	for (int stripe = 1; stripe < stripes; stripe++)
+		for (size_t i = 0; i < partials[0].size(); i++) partials[0][i] += partials[stripe][i];
+
+	int worst = 0, channel = 0;
+	double worst_error = -1, spread = 0;
+
+	for (int k = 0; k < clusters; k++)
+	{
+		const double* moment = partials[0].data() + static_cast<size_t>(k) * 7;
+		if (moment[0] <= 0) continue;
+
+		double error = 0, widest = -1;
+		int widest_channel = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			const double variance = max(moment[4 + c] / moment[0] - pow(moment[1 + c] / moment[0], 2), 0.0);
+			error += variance * moment[0];
+			if (variance > widest)
+			{
+				widest = variance;
+				widest_channel = c;
+			}
+		}
+
+		if (error > worst_error)
+		{
+			worst_error = error;
+			worst = k;
+			channel = widest_channel;
+			spread = sqrt(widest);
+		}
+	}
+
+	// the two halves start one standard deviation either side of the old center
+	Mat split = centers.row(worst).clone();
+	const float middle = centers.at<float>(worst, channel);
+	centers.at<float>(worst, channel) = static_cast<float>(middle - spread);
+	split.at<float>(0, channel) = static_cast<float>(middle + spread);
+	centers.push_back(split);
+
+	for (int i = 0; i < count; i++)
+		if (labels.at<int>(i) == worst && data.at<float>(i, channel) > middle) labels.at<int>(i) = clusters;
+}
+
+// assumptions:
+//	input: CV_8UC3 image loaded in opencv
+//	first, last: cluster sizes swept, 1 <= first <= last
+//	options: selects the kmeans engine and its settings
+//	emit: called with the pixel labels and centers of every cluster size, only valid until emit returns
+// outcome: emit called for every cluster size in [first, last] in increasing order, the pixels are converted once,
+//	every cluster size after the first starts from the previous centers with its worst cluster split in two
+static void kmeans_sweep(const Mat& input, int first, int last, const Options& options,
+	const function<void(const Mat&, const Mat&)>& emit)
+{
+	TermCriteria criteria(TermCriteria::EPS + TermCriteria::MAX_ITER, ITER, EPSILON);
+	Mat data, weights, labels, centers;
+
+	// the histogram engine sweeps the occupied bins, the others every pixel
+	ColorHistogram histogram;
+	if (options.engine == KMeansEngine::HISTOGRAM)
+	{
+		color_histogram(input, options.histogram_bits, histogram);
+		data = histogram.colors;
+		weights = histogram.weights;
+	}
+	else
+	{
+		input.convertTo(data, CV_32F);
+		data = data.reshape(1, static_cast<int>(data.total()));
+	}
+
+	KMeansOptions warm = options.kmeans;
+	warm.seeding = KMeansSeeding::INITIAL;
+
+	for (int clusters = first; clusters <= min(last, data.rows); clusters++)
+	{
+		if (clusters == first)
+		{
+			if (options.engine == KMeansEngine::OPENCV)
+				kmeans(data, clusters, labels, criteria, ATTEMPTS, KMEANS_RANDOM_CENTERS, centers);
+			else
+				pixel_kmeans<3>(data, weights, clusters, labels, criteria, ATTEMPTS, options.kmeans, centers);
+		}
+		else
+		{
+			centers = centers.reshape(1, clusters - 1);
+			split_worst_cluster(data, weights, labels, centers);
+
+			if (options.engine == KMeansEngine::OPENCV)
+				kmeans(data, clusters, labels, criteria, 1, KMEANS_USE_INITIAL_LABELS, centers);
+			else
+				pixel_kmeans<3>(data, weights, clusters, labels, criteria, 1, warm, centers);
+		}
+
+		// the labels are refined in place by the next cluster size, so only the histogram engine needs a pixel copy
+		if (options.engine == KMeansEngine::HISTOGRAM)
+		{
+			Mat pixel_labels;
+			histogram_labels(input, histogram, labels, pixel_labels);
+			emit(pixel_labels, centers);
+		}
+		else emit(labels, centers);
+	}
+	data.release();
+	labels.release();
+}
+
+// assumptions:
+//	input: CV_8UC3 image loaded in opencv
+//	file_dir: correct directory of the image
+//	first, last: cluster sizes swept, 1 <= first <= last
+//	options: selects the kmeans or slic engine and its settings
+//	emit: called once per output
+// outcome: the segments of segmentation for every cluster size in [first, last] handed to emit one cluster size
+//	at a time, each is cut and emitted before the next size is computed so only one size is held at once,
+//	the kmeans engines warm start every cluster size from the previous one, see kmeans_sweep, and the slic engine
+//	merges one set of superpixels down to every size, largest first
+void segmentation_sweep(Mat& input, const string& file_dir, int first, int last, const Options& options,
+	const function<void(const Segment&)>& emit)
+{
+	CV_Assert(first >= 1 && first <= last);
+
+	auto extract = [&](const Mat& labels, const Mat& centers)
+	{
+		vector<Mat> clustered;
+		Mat full;
+		extract_segments(input, labels, centers, clustered, full);
+
+		const int clusters = static_cast<int>(clustered.size());
+		for (int center_id = 0; center_id < clusters; center_id++)
+			emit({ file_dir, format("%s_%s%d_%d", file_dir.c_str(), segment_method(options), clusters, center_id),
+				clustered[center_id] });
+		emit({ file_dir, format("%s_%s%d_full", file_dir.c_str(), segment_method(options), clusters), full });
+	};
+
+	if (options.engine == KMeansEngine::SLIC)
+	{
+		vector<int> sizes;
+		for (int clusters = first; clusters <= last; clusters++) sizes.push_back(clusters);
+
+		Mat superpixels;
+		const int count = slic_superpixels(input, max(options.slic_superpixels, 1), options.slic_compactness,
+			options.slic_iterations, superpixels);
+		merge_superpixels(input, superpixels, count, sizes, [&](size_t, const Mat& labels, const Mat& centers)
+		{
+			extract(labels, centers);
+		});
+	}
+	else kmeans_sweep(input, first, last, options, extract);
+}
+
+// assumptions:
+//	input: CV_8UC3 image loaded in opencv
+//	file_dir: correct directory of the image
+//	cluster_size: integer values: [2-20]
+//	options: kmeans engine and settings, tile_rows and tile_sample size the tiles and the sample
+//	emit: called once per output, the segment image is only valid until emit returns
+// outcome: the same segments as segmentation handed to emit one at a time, built with a bounded amount of memory
+//	centers are fitted on a sample drawn with a fixed seed and labels are assigned one band of rows at a time,
+//	so only the input, one byte of label per pixel, one output and the bands being assigned are ever held,
+//	the slic engine labels the whole image at once and only bounds the outputs
+void segmentation_tiled(const Mat& input, const string& file_dir, const int& cluster_size, const Options& options,
+	const function<void(const Segment&)>& emit)
+{
+	CV_Assert(input.type() == CV_8UC3 && input.isContinuous());
+	CV_Assert(cluster_size >= 1 && cluster_size <= 255);
+
+	const int clusters = cluster_size;
+	const size_t count = input.total();
+	const Vec3b* pixels = input.ptr<Vec3b>();
+
+	Mat centers;
+	TermCriteria criteria(TermCriteria::EPS + TermCriteria::MAX_ITER, ITER, EPSILON);
+
+	// one byte per pixel instead of an int label, the float copy only exists per band
+	Mat label_map(input.size(), CV_8U);
+
+	// superpixels need their neighbors, so the slic labels are computed whole and narrowed to one byte,
+	// the histogram engine fits on the full histogram, which is small and independent of the tiling
+	if (options.engine == KMeansEngine::SLIC)
+	{
+		vector<Mat> merged_labels, merged_centers;
+		slic_clusters(input, { clusters }, options, merged_labels, merged_centers);
+		merged_labels.front().reshape(1, input.rows).convertTo(label_map, CV_8U);
+		centers = merged_centers.front();
+	}
+	else if (options.engine == KMeansEngine::HISTOGRAM)
+	{
+		ColorHistogram histogram;
+		color_histogram(input, options.histogram_bits, histogram);
+
+		KMeansOptions seeded = options.kmeans;
+		seeded.seed = TILE_SEED;
+		Mat bin_labels, fitted;
+		const int fitted_clusters = min(clusters, histogram.colors.rows);
+		pixel_kmeans<3>(histogram.colors, histogram.weights, fitted_clusters, bin_labels, criteria, ATTEMPTS, seeded, fitted);
+
+		centers.create(clusters, 3, CV_32F);
+		for (int k = 0; k < clusters; k++) fitted.row(min(k, fitted_clusters - 1)).copyTo(centers.row(k));
+	}
+	else
+	{
+		// sampled pixel positions only depend on the image size, never on the tiling
+		const size_t samples = max<size_t>(min(count, options.tile_sample), static_cast<size_t>(clusters));
+		Mat data(static_cast<int>(samples), 3, CV_32F), labels;
+		RNG rng(TILE_SEED);
+
+		for (size_t i = 0; i < samples; i++)
+		{
+			const size_t index = samples == count ? i : min(count - 1, static_cast<size_t>(rng.uniform(0.0, 1.0) * count));
+			float* point = data.ptr<float>(static_cast<int>(i));
+
+			for (int c = 0; c < 3; c++) point[c] = pixels[index][c];
+		}
+
+		if (options.engine == KMeansEngine::PIXEL)
+		{
+			KMeansOptions seeded = options.kmeans;
+			seeded.seed = TILE_SEED;
+			pixel_kmeans<3>(data, clusters, labels, criteria, ATTEMPTS, seeded, centers);
+		}
+		else
+		{
+			// cv::kmeans only draws from the shared theRNG, so every attempt starts from sample points picked by
+			//	the local generator and their nearest labels instead, one attempt at a time keeps the best
+			double best_compactness = DBL_MAX;
+			for (int attempt = 0; attempt < ATTEMPTS; attempt++)
+			{
+				Mat initial(clusters, 3, CV_32F), attempt_labels(data.rows, 1, CV_32S), attempt_centers;
+				for (int k = 0; k < clusters; k++) data.row(rng.uniform(0, data.rows)).copyTo(initial.row(k));
+
+				for (int i = 0; i < data.rows; i++)
+				{
+					const float* point = data.ptr<float>(i);
+					double nearest = DBL_MAX;
+					for (int k = 0; k < clusters; k++)
+					{
+						const float* center = initial.ptr<float>(k);
+						double distance = 0;
+						for (int c = 0; c < 3; c++) distance += (point[c] - center[c]) * (point[c] - center[c]);
+						if (distance < nearest)
+						{
+							nearest = distance;
+							attempt_labels.at<int>(i) = k;
+						}
+					}
+				}
+
+				const double compactness = kmeans(data, clusters, attempt_labels, criteria, 1, KMEANS_USE_INITIAL_LABELS,
+					attempt_centers);
+				if (compactness < best_compactness)
+				{
+					best_compactness = compactness;
+					labels = attempt_labels;
+					centers = attempt_centers;
+				}
+			}
+		}
+	}
+	centers = centers.reshape(1, clusters);
+
+	// kmeans labels are assigned one band of rows at a time
+	if (options.engine != KMeansEngine::SLIC)
+	{
+		const int tile_rows = max(options.tile_rows, 1);
+		const int tiles = (input.rows + tile_rows - 1) / tile_rows;
+
+		parallel_for_(Range(0, tiles), [&](const Range& range)
+		{
+			vector<float> points, distances;
+			vector<int> tile_labels;
+
+			for (int tile = range.start; tile < range.end; tile++)
+			{
+				const int first = tile * tile_rows;
+				const size_t begin = static_cast<size_t>(first) * input.cols;
+				const size_t size = static_cast<size_t>(min(tile_rows, input.rows - first)) * input.cols;
+
+				points.resize(size * 3);
+				distances.resize(size);
+				tile_labels.resize(size);
+
+				for (size_t i = 0; i < size; i++)
+					for (int c = 0; c < 3; c++) points[i * 3 + c] = pixels[begin + i][c];
+
+				pixel_assign<3>(points.data(), size, centers.ptr<float>(), clusters, tile_labels.data(), distances.data());
+
+				uchar* label = label_map.ptr<uchar>() + begin;
+				for (size_t i = 0; i < size; i++) label[i] = static_cast<uchar>(tile_labels[i]);
+			}
+		});
+	}
+
+	// every output is built into the same buffer and handed off before the next one overwrites it
+	Mat palette, output(input.size(), CV_8UC3);
+	centers.convertTo(palette, CV_8U);
+
+	for (int center_id = 0; center_id <= clusters; center_id++)
+	{
+		const bool full = center_id == clusters;
+
+		parallel_for_(Range(0, input.rows), [&](const Range& band)
+		{
+			const Vec3b* colors = palette.ptr<Vec3b>();
+
+			for (int y = band.start; y < band.end; y++)
+			{
+				const Vec3b* pixel = input.ptr<Vec3b>(y);
+				const uchar* label = label_map.ptr<uchar>(y);
+				Vec3b* target = output.ptr<Vec3b>(y);
+
+				if (full) for (int x = 0; x < input.cols; x++) target[x] = colors[label[x]];
+				else for (int x = 0; x < input.cols; x++) target[x] = label[x] == center_id ? pixel[x] : Vec3b(0, 0, 0);
+			}
+		});
+
+		const string name = full ? format("%s_%s%d_full", file_dir.c_str(), segment_method(options), clusters)
+			: format("%s_%s%d_%d", file_dir.c_str(), segment_method(options), clusters, center_id);
+		emit({ file_dir, name, output });
+	}
+}
+
+// outcome: returns string converted from wstring
+string to_string(const wstring wide_string)
+{
+	return converter.to_bytes(wide_string);
+}
+
+// outcome: returns wstring converted from string
+wstring to_wstring(const string normal_string)
+{
+	return converter.from_bytes(normal_string);
+}
+
+// assuptions:
+//	file_name: is a valid file in the working directory that contains a
+//		working gcp api key for the vision api
+// outcome: api_key is stores a valid gcp api key or program exits if key cannot be read
+void load_key(const string& file_name, string& api_key)
+{
+	ifstream key_file(file_name);
+
+	if (!getline(key_file, api_key))
+	{
+		printf("load key failure\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// how an annotate attempt ended, throttled and retry attempts are sent again after a backoff
+enum class RequestStatus { SUCCESS, THROTTLED, RETRY, FAILURE };
+
+// assumptions:
+//	address: annotate uri with its api key
+//	timeout: deadline of one attempt
+// outcome: returns the client of address and timeout, created on first use and kept for the rest of the process
+//	so later calls and concurrent jobs reuse its open connections and tls sessions instead of handshaking again,
+//	never destroyed since cpprest may tear its thread pool down first at exit
+http::client::http_client& annotate_client(const uri& address, chrono::milliseconds timeout)
+{
+	static mutex clients_mutex;
+	static auto* clients = new map<pair<wstring, long long>, unique_ptr<http::client::http_client>>();
+
+	lock_guard<mutex> lock(clients_mutex);
+
+	unique_ptr<http::client::http_client>& client = (*clients)[{ address.to_string(), static_cast<long long>(timeout.count()) }];
+	if (!client)
+	{
+		http::client::http_client_config config;
+		config.set_timeout(timeout);
+		client = make_unique<http::client::http_client>(address, config);
+	}
+
+	return *client;
+}
+
+// assuptions:
+//	encodings: base64 encoded images the requests are built from
+//	batch_starts: index of the first image of every request, as filled by batch_requests
+//	api_key: string that contains valid gcp vision api key
+//	image_labels: properly initialized vector with one entry per image
+//	options: endpoint, rate and concurrency limits, attempt timeout and attempts per request
+//	store: interns the label descriptions
+// outcome:
+//	image_labels will be populated with all the label annotations associated with
+//		with the api responses of each image, images without a valid response stay empty
+//	requests are paced by a token bucket and kept in flight up to an aimd limit that backs off on 429 and 5xx,
+//		throttled and failed attempts are retried with jittered exponential backoff until the attempts run out
+//	a request body only exists while its request is in flight, returns the number of requests given up on
+size_t make_requests(const vector<string>& encodings, const vector<size_t>& batch_starts, const string& api_key, 
+	vector<ImageLabels>& image_labels, const Options& options, LabelStore& store)
+{	
+	const chrono::milliseconds BACKOFF_BASE(250);
+	const chrono::milliseconds BACKOFF_CAP(16000);
+
+	struct Attempt
+	{
+		size_t batch;
+		int attempt;
+		chrono::steady_clock::time_point not_before;
+	};
+
+	struct InFlight
+	{
+		Attempt attempt;
+		pplx::task<RequestStatus> status;
+	};
+
+	if (batch_starts.empty()) return 0;
+
+	// setup uri
+	uri_builder uri_path(to_wstring(options.endpoint));
+	uri_path.append_path(L"v1/images:annotate");
+	uri_path.append_query(L"key", to_wstring(api_key));
+	
+	// setup api, every attempt has its own deadline and the connections stay open between calls
+	http::client::http_client& api = annotate_client(uri_path.to_uri(), chrono::milliseconds(max(options.request_timeout, 1)));
+
+	// responses complete on the cpprest thread pool, each one only writes the labels of its own images,
+	// the limits are only touched here on the calling thread
+	TokenBucket bucket(options.request_rate, static_cast<double>(options.request_burst));
+	AimdWindow window(options.request_window);
+	mt19937 jitter(random_device{}());
+	deque<Attempt> pending;
+	vector<InFlight> in_flight;
+	size_t failures = 0, retries = 0;
+
+	// signalled by every finished attempt, shared with the continuations that may outlive this call
+	struct Completions
+	{
+		mutex completions_mutex;
+		condition_variable finished;
+	};
+	shared_ptr<Completions> completions = make_shared<Completions>();
+
+	for (size_t batch = 0; batch < batch_starts.size(); batch++) pending.push_back({ batch, 0, chrono::steady_clock::now() });
+
+	while (!pending.empty() || !in_flight.empty())
+	{
+		// start every attempt that is due while the limits allow it
+		while (!pending.empty() && in_flight.size() < window.limit() && pending.front().not_before <= chrono::steady_clock::now())
+		{
+			const chrono::milliseconds wait = bucket.take();
+			if (wait.count() > 0)
+			{
+				this_thread::sleep_for(wait);
+				continue;
+			}
+
+			const Attempt attempt = pending.front();
+			pending.pop_front();
+
+			const size_t first = batch_starts[attempt.batch];
+			const size_t last = attempt.batch + 1 < batch_starts.size() ? batch_starts[attempt.batch + 1] : image_labels.size();
+
+			// setup request, the utf-8 body is moved into the request instead of being serialized again
+			string body;
+			generate_json(encodings, first, last, body);
+
+			// the span of a request ends on whichever thread completes it
+			const int64_t started = trace_now();
+			const uint64_t sent = body.size();
+			shared_ptr<uint64_t> received = make_shared<uint64_t>(0);
+
+			http::http_request post(http::methods::POST);
+			post.set_body(move(body), "application/json");
+			
+			// async request
+			pplx::task<RequestStatus> async_chain = api.request(post)
+			
+			// handle http_response from api.request, only a complete answer is parsed
+			.then([&image_labels, &store, first, last, received](http::http_response response)
+			{
+				const http::status_code code = response.status_code();
+
+				if (code == TOO_MANY_REQUESTS) return pplx::task_from_result(RequestStatus::THROTTLED);
+				if (code >= 500) return pplx::task_from_result(RequestStatus::THROTTLED);
+				if (code != http::status_codes::OK)
+				{
+					printf("request status:%d\n", static_cast<int>(code));
+					return pplx::task_from_result(code == http::status_codes::RequestTimeout ? RequestStatus::RETRY : RequestStatus::FAILURE);
+				}
+
+				return response.extract_utf8string(true).then([&image_labels, &store, first, last, received](const string& body)
+				{
+					*received = body.size();
+					if (parse_responses(body, first, last, image_labels, store)) return RequestStatus::SUCCESS;
+
+					printf("response parse failure\n");
+					return RequestStatus::RETRY;
+				});
+			})
+
+			// timeouts and connection failures are retried like any other transient failure
+			.then([started, sent, received](pplx::task<RequestStatus> previous)
+			{
+				RequestStatus status = RequestStatus::RETRY;
+				try { status = previous.get(); }
+				catch (const exception& e) { printf("request exception:%s\n", e.what()); }
+
+				trace_record("http_request", started, trace_now(), sent, *received);
+				return status;
+			});
+
+			// the chain is done by the time this runs, so a waiter that sees the signal also sees is_done
+			async_chain.then([completions](RequestStatus)
+			{
+				lock_guard<mutex> lock(completions->completions_mutex);
+				completions->finished.notify_one();
+			});
+
+			in_flight.push_back({ attempt, async_chain });
+		}
+
+		// wait for an attempt to finish, or for the next retry to become due when the window has room for it
+		if (in_flight.empty())
+		{
+			if (!pending.empty()) this_thread::sleep_until(pending.front().not_before);
+			continue;
+		}
+
+		{
+			unique_lock<mutex> lock(completions->completions_mutex);
+			auto any_done = [&in_flight]()
+			{
+				return any_of(in_flight.begin(), in_flight.end(), [](const InFlight& request) { return request.status.is_done(); });
+			};
+
+			if (!pending.empty() && in_flight.size() < window.limit())
+				completions->finished.wait_until(lock, pending.front().not_before, any_done);
+			else completions->finished.wait(lock, any_done);
+		}
+
+		for (size_t i = in_flight.size(); i-- > 0;)
+		{
+			if (!in_flight[i].status.is_done()) continue;
+
+			Attempt attempt = in_flight[i].attempt;
+			const RequestStatus status = in_flight[i].status.get();
+			in_flight.erase(in_flight.begin() + i);
+
+			if (status == RequestStatus::SUCCESS)
+			{
+				window.success();
+				continue;
+			}
+			if (status == RequestStatus::THROTTLED) window.throttled();
+
+			if (status == RequestStatus::FAILURE || attempt.attempt + 1 >= max(options.request_attempts, 1))
+			{
+				failures++;
+				continue;
+			}
+
+			// retries go behind the attempts already due so one stubborn request never starves the rest
+			attempt.not_before = chrono::steady_clock::now() + backoff(attempt.attempt, BACKOFF_BASE, BACKOFF_CAP, jitter);
+			attempt.attempt++;
+			retries++;
+			pending.insert(upper_bound(pending.begin(), pending.end(), attempt,
+				[](const Attempt& a, const Attempt& b) { return a.not_before < b.not_before; }), attempt);
+		}
+	}
+
+	if (retries > 0 || failures > 0) printf("request retries:%zu failures:%zu\n", retries, failures);
+
+	return failures;
+}
+
+// assumptions:
+//	encodings: properly intialized vector of base64 encoded images
+//	batch_starts: properly intialized vector
+//	options: images per request and request body limit
+// outcome: encodings split into vision api requests, each packing up to options.batch_images images
+//	while staying under options.max_body_bytes, batch_starts holds the index of the first image of each request
+void batch_requests(const vector<string>& encodings, vector<size_t>& batch_starts, const Options& options)
+{
+	// json around each image content, counted towards the body limit
+	const size_t REQUEST_OVERHEAD = 160;
+
+	size_t index = 0, body_bytes = 0;
+
+	for (size_t i = 0; i < encodings.size(); i++)
+	{	
+		const size_t bytes = encodings[i].size() + REQUEST_OVERHEAD;
+
+		// start a new request when the current one is full, a single image never gets split
+		if (i == 0 || index >= max<size_t>(options.batch_images, 1) || body_bytes + bytes > options.max_body_bytes)
+		{
+			batch_starts.push_back(i);
+			index = 0;
+			body_bytes = 0;
+		}
+
+		index++;
+		body_bytes += bytes;
+	}
+}
+
+// assumptions:
+//	encodings: base64 encoded images, base64 never needs json escaping
+//	first, last: images of the request, [first, last) of encodings
+//	body: buffer reused between calls, its capacity is kept
+// outcome: body holds the utf-8 vision api request of the images, sized once and written in place
+//	so it takes about the size of the encodings and no intermediate json tree or wide copy is built
+void generate_json(const vector<string>& encodings, size_t first, size_t last, string& body)
+{	
+	TraceScope trace("generate_json");
+
+	const string BODY_PREFIX = "{\"requests\":[";
+	const string BODY_SUFFIX = "]}";
+	const string IMAGE_PREFIX = format("{\"features\":[{\"maxResults\":%zu,\"type\":\"%s\",\"model\":\"%s\"}],"
+		"\"image\":{\"content\":\"", MAX_RESULTS, TYPE.c_str(), MODEL.c_str());
+	const string IMAGE_SUFFIX = "\"}}";
+
+	size_t size = BODY_PREFIX.size() + BODY_SUFFIX.size();
+	for (size_t i = first; i < last; i++) size += IMAGE_PREFIX.size() + encodings[i].size() + IMAGE_SUFFIX.size() + 1;
+
+	body.clear();
+	body.reserve(size);
+	body += BODY_PREFIX;
+
+	uint64_t encoded = 0;
+	for (size_t i = first; i < last; i++)
+	{
+		if (i > first) body += ',';
+		body += IMAGE_PREFIX;
+		body += encodings[i];
+		body += IMAGE_SUFFIX;
+		encoded += encodings[i].size();
+	}
+	trace.bytes_in(encoded);
+
+	body += BODY_SUFFIX;
+	trace.bytes_out(body.size());
+}
+
+// outcome: returns every request setting that changes the labels of an image
+string request_parameters(const Options& options)
+{
+	return format("%s|%zu|%s|%s", TYPE.c_str(), MAX_RESULTS, MODEL.c_str(), options.endpoint.c_str());
+}
+
+// outcome: returns every setting that changes the labels of an image or where they are stored
+string label_parameters(int cluster_size, const Options& options)
+{
+	return segmentation_parameters(cluster_size, options) + "|" + request_parameters(options)
+		+ format("|json=%d|index=%s|upload=%d/%d/%zu/%d", options.json_labels ? 1 : 0, options.label_index.c_str(),
+			options.upload_crop ? 1 : 0, options.upload_edge, options.upload_bytes, options.upload_base ? 1 : 0);
+}
+
+// outcome: returns every setting that changes the segments of an image, grabcut windows and segment codec included
+string segmentation_parameters(int cluster_size, const Options& options)
+{
+	return format("k=%d|sweep=%d-%d|engine=%d|iter=%d|epsilon=%g|attempts=%d|seeding=%d|batch=%d|bits=%d|tile=%d/%zu|windows=%s|slic=%d/%g/%d|grabcut=%d/%d|codec=%s/%d",
+		cluster_size, options.sweep_first, options.sweep_last, static_cast<int>(options.engine), ITER, EPSILON, ATTEMPTS,
+		static_cast<int>(options.kmeans.seeding), options.kmeans.batch_size, options.histogram_bits, options.tile_rows,
+		options.tile_sample, options.windows.c_str(), options.slic_superpixels, options.slic_compactness, options.slic_iterations,
+		static_cast<int>(options.grabcut), options.grabcut_edge,
+		options.output_codec.c_str(), options.output_quality);
+}
+
+// assumptions:
+//	encodings: base64 encoded images, empty entries are skipped
+//	owners: directory of every encoding
+//	names: id of every encoding within its directory, ex the segment name
+//	api_key: valid gcp vision api key
+//	store: receives the labels of every directory and image
+//	options: request settings passed on to batch_requests and make_requests
+//	cache: label cache or nullptr
+//	failed: nullptr or receives the owner of every encoding left without labels, once per encoding
+// outcome: encodings are labeled and the labels of each image are merged into the statistics of its directory
+//	and kept under its name,
+//	images found in cache are never requested and every answered image is added to it,
+//	returns the number of requests given up on
+size_t label_encodings(vector<string>& encodings, vector<string>& owners, vector<string>& names, const string& api_key,
+	LabelStore& store, const Options& options, LabelCache* cache, vector<string>* failed)
+{
+	vector<size_t> batch_starts;
+	vector<uint64_t> keys;
+
+	// drop failed encodings so every request entry holds an image
+	for (size_t i = encodings.size(); i-- > 0;)
+	{
+		store.add_directory(owners[i]);
+
+		if (encodings[i].empty())
+		{
+			if (failed) failed->push_back(owners[i]);
+			encodings.erase(encodings.begin() + i);
+			owners.erase(owners.begin() + i);
+			names.erase(names.begin() + i);
+		}
+	}
+
+	// cached images are answered here, only the misses are packed into requests
+	if (cache)
+	{
+		const string parameters = request_parameters(options);
+		vector<ScoredLabel> labels;
+		size_t kept = 0;
+
+		for (size_t i = 0; i < encodings.size(); i++)
+		{
+			const uint64_t key = LabelCache::key(encodings[i], parameters);
+
+			labels.clear();
+			if (cache->find(key, store, labels))
+			{
+				store.merge(owners[i], names[i], labels);
+				continue;
+			}
+
+			if (kept != i)
+			{
+				encodings[kept] = move(encodings[i]);
+				owners[kept] = move(owners[i]);
+				names[kept] = move(names[i]);
+			}
+			keys.push_back(key);
+			kept++;
+		}
+
+		encodings.resize(kept);
+		owners.resize(kept);
+		names.resize(kept);
+	}
+
+	// batches span directories, the labels of each image are mapped back to its own directory
+	batch_requests(encodings, batch_starts, options);
+
+	vector<ImageLabels> image_labels(owners.size());
+	const size_t failures = make_requests(encodings, batch_starts, api_key, image_labels, options, store);
+	encodings.clear();
+
+	// images of a request given up on, or answered with an error, have no labels
+	for (size_t i = 0; i < owners.size(); i++)
+	{
+		if (!image_labels[i])
+		{
+			if (failed) failed->push_back(owners[i]);
+			continue;
+		}
+
+		if (cache) cache->insert(keys[i], store, *image_labels[i]);
+		store.merge(owners[i], names[i], *image_labels[i]);
+	}
+
+	return failures;
+}
+
+// assumptions:
+//	path: valid path in the working directory that contains jpeg images grouped by directories
+//	api_key: valid gcp vision api key
+//	store: receives the labels of every directory
+//	options: upload settings passed on to prepare_upload and request settings passed on to batch_requests
+//		and make_requests
+//	cache: label cache or nullptr, see label_encodings
+//	base: path holds base images, uploaded by prepare_base_upload instead of prepare_upload
+// outcome: images in path are labeled and merged into store, returns the number of requests given up on
+// improvements:
+//	trade constant for variable
+//	more resilient failure handling
+size_t label_images(const filesystem::path& path, const string& api_key, LabelStore& store, const Options& options,
+	LabelCache* cache, bool base)
+{
+	Mat image;
+	vector<string> encodings, owners, names;
+
+	// prepare each image found in path for upload and remember its directory and name
+	for (const auto& entry: filesystem::recursive_directory_iterator(path))
+	{
+		if (entry.is_directory()) store.add_directory(entry.path().filename().string());
+
+		if (entry.is_regular_file())
+		{	
+			image = imread(entry.path().string());
+			string encoding = image.empty() ? string() : base ? prepare_base_upload(image, options) : prepare_upload(image, options);
+
+			if (!encoding.empty())
+			{
+				encodings.push_back(move(encoding));
+				owners.push_back(entry.path().parent_path().filename().string());
+				names.push_back(entry.path().stem().string());
+			}
+			else printf("conversion failure\n");
+		}
+	}
+
+	return label_encodings(encodings, owners, names, api_key, store, options, cache);
+}
+
+// outcome: returns the file write_json writes the labels of directory to
+string json_path(const filesystem::path& path, const string& directory, const string& name)
+{
+	return (path / directory / (name + ".json")).string();
+}
+
+// outcome: returns the files save_labels writes the labels of directory to
+vector<string> label_files(const filesystem::path& path, const string& directory, const Options& options)
+{
+	vector<string> files;
+	if (options.json_labels) files = { json_path(path, directory, "base_labels"), json_path(path, directory, "segment_labels") };
+	if (!options.label_index.empty()) files.push_back(options.label_index);
+
+	return files;
+}
+
+// outcome: returns labels as a json array of objects with their description, max score, mean score and image count
+json::value label_json(const vector<pair<string, LabelStats>>& labels)
+{
+	json::value array = json::value::array();
+	size_t index = 0;
+
+	for (const auto& [description, stats]: labels)
+	{
+		json::value label = json::value::object();
+		label[L"description"] = json::value(to_wstring(description));
+		label[L"max_score"] = json::value(stats.max_score);
+		label[L"mean_score"] = json::value(stats.mean_score());
+		label[L"count"] = json::value(static_cast<int>(stats.count));
+		array[index++] = label;
+	}
+
+	return array;
+}
+
+// assumptions:
+//	path: valid path in working directory
+//	store: labels of every directory
+//	name: non-empty string
+//	sink: writes the files in the background, nullptr writes them before returning
+// outcome: labels of every directory with their max score, mean score and image count written to disk specified by path
+void write_json(const filesystem::path& path, const LabelStore& store, const string name, OutputSink* sink)
+{	
+	TraceScope trace("write_json");
+	uint64_t written = 0;
+	json::value data;
+
+	// each iteration of key is one json object to written to disk
+	for (const auto& [key, value]: store.snapshot())
+	{	
+		data = json::value::object();
+		data[to_wstring(key)] = label_json(value);
+
+		// create directory with this key name, fails if already exists		
+		error_code error;
+		filesystem::create_directory(path / key, error);
+
+		// write file to directory, the sink takes the write off the calling thread
+		const string file_path = json_path(path, key, name);
+		string serialized = to_string(data.serialize());
+		written += serialized.size();
+
+		if (sink)
+		{
+			sink->write(file_path, serialized);
+			continue;
+		}
+
+		ofstream json_file(file_path);
+		json_file << serialized;
+		json_file.close();
+	}
+
+	trace.bytes_out(written);
+}
+
+// assumptions:
+//	path: output directory of the json files
+//	store: labels of every directory
+//	name: set the labels are stored under, ex base_labels
+//	sink: writes the json files in the background, nullptr writes them before returning
+//	index: label index or nullptr
+// outcome: labels of every image and segment appended to index as one chunk under its directory, and the
+//	directory statistics written as json files by write_json
+//	when options.json_labels
+void save_labels(const filesystem::path& path, const LabelStore& store, const string& name, const Options& options,
+	OutputSink* sink, LabelIndex* index)
+{
+	if (index) index->append(store, name);
+	if (options.json_labels) write_json(path, store, name, sink);
+}
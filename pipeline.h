@@ -0,0 +1,173 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// vcpkg
+#include <cpprest/json.h>
+
+// custom
+#include "label_cache.h"
+#include "label_index.h"
+#include "label_store.h"
+#include "options.h"
+#include "output_sink.h"
+#include "segments.h"
+
+// stages of the segmentation and labeling pipeline shared by segmentation-context and benchmark
+
+// assumptions:
+//	input: valid image file loaded in opencv
+//  file_dir: correct directory of the image 
+//	cluster_size: integer values: [2-20]
+//	options: selects the kmeans engine and its settings
+//	segments: properly initialized vector
+//	pixel_labels, pixel_centers: nullptr or receive the CV_32S N x 1 labels and CV_32F K x 3 centers of the kmeans,
+//		so later stages can start from them
+// outcome: outputing the image into segments, appended to segments in memory
+void segmentation(cv::Mat& input, const std::string& file_dir, const int& cluster_size, const Options& options,
+	std::vector<Segment>& segments, cv::Mat* pixel_labels = nullptr, cv::Mat* pixel_centers = nullptr);
+
+// assumptions:
+//	input: CV_8UC3 image loaded in opencv
+//	file_dir: correct directory of the image
+//	first, last: cluster sizes swept, 1 <= first <= last
+//	options: selects the kmeans or slic engine and its settings
+//	emit: called once per output
+// outcome: the segments of segmentation for every cluster size in [first, last] handed to emit one cluster size
+//	at a time, each is cut and emitted before the next size is computed so only one size is held at once,
+//	each kmeans cluster size is warm started from the previous one by splitting its worst cluster, the slic
+//	engine merges one set of superpixels down to every size, largest first
+void segmentation_sweep(cv::Mat& input, const std::string& file_dir, int first, int last, const Options& options,
+	const std::function<void(const Segment&)>& emit);
+
+// assumptions:
+//	input: CV_8UC3 image loaded in opencv
+//	file_dir: correct directory of the image
+//	cluster_size: integer values: [2-20]
+//	options: kmeans engine and settings, tile_rows and tile_sample size the tiles and the sample
+//	emit: called once per output, the segment image is only valid until emit returns
+// outcome: the same segments as segmentation handed to emit one at a time, built with a bounded amount of memory,
+//	identical for any tile_rows, the slic engine labels the whole image at once and only bounds the outputs
+void segmentation_tiled(const cv::Mat& input, const std::string& file_dir, const int& cluster_size, const Options& options,
+	const std::function<void(const Segment&)>& emit);
+
+// outcome: returns string converted from wstring
+std::string to_string(const std::wstring wide_string);
+
+// outcome: returns wstring converted from string
+std::wstring to_wstring(const std::string normal_string);
+
+// assuptions:
+//	file_name: is a valid file in the working directory that contains a
+//		working gcp api key for the vision api
+// outcome: api_key is stores a valid gcp api key or program exits if key cannot be read
+void load_key(const std::string& file_name, std::string& api_key);
+
+// assuptions:
+//	encodings: base64 encoded images the requests are built from
+//	batch_starts: index of the first image of every request, as filled by batch_requests
+//	api_key: string that contains valid gcp vision api key
+//	image_labels: properly initialized vector with one entry per image
+//	options: endpoint, rate and concurrency limits, attempt timeout and attempts per request
+//	store: interns the label descriptions
+// outcome: image_labels will be populated with all the label annotations of each image, throttled and
+//	failed requests are retried with backoff, returns the number of requests given up on
+size_t make_requests(const std::vector<std::string>& encodings, const std::vector<size_t>& batch_starts,
+	const std::string& api_key, std::vector<ImageLabels>& image_labels, const Options& options, LabelStore& store);
+
+// assumptions:
+//	encodings: properly intialized vector of base64 encoded images
+//	batch_starts: properly intialized vector
+//	options: images per request and request body limit
+// outcome: the index of the first image of each vision api request stored in batch_starts
+void batch_requests(const std::vector<std::string>& encodings, std::vector<size_t>& batch_starts, const Options& options);
+
+// assumptions:
+//	encodings: base64 encoded images
+//	first, last: images of the request, [first, last) of encodings
+//	body: buffer reused between calls, its capacity is kept
+// outcome: body holds the utf-8 vision api request of the images, about the size of the encodings
+void generate_json(const std::vector<std::string>& encodings, size_t first, size_t last, std::string& body);
+
+// outcome: returns every request setting that changes the labels of an image
+std::string request_parameters(const Options& options);
+
+// outcome: returns every setting that changes the labels of an image or where they are stored
+std::string label_parameters(int cluster_size, const Options& options);
+
+// outcome: returns every setting that changes the segments of an image, grabcut windows and segment codec included
+std::string segmentation_parameters(int cluster_size, const Options& options);
+
+// assumptions:
+//	encodings: base64 encoded images, empty entries are skipped
+//	owners: directory of every encoding
+//	names: id of every encoding within its directory, ex the segment name
+//	api_key: valid gcp vision api key
+//	store: receives the labels of every directory and image
+//	options: request settings passed on to batch_requests and make_requests
+//	cache: label cache or nullptr
+//	failed: nullptr or receives the owner of every encoding left without labels, once per encoding
+// outcome: encodings are labeled and the labels of each image are merged into the statistics of its directory
+//	and kept under its name,
+//	images found in cache are never requested and every answered image is added to it,
+//	returns the number of requests given up on
+size_t label_encodings(std::vector<std::string>& encodings, std::vector<std::string>& owners, std::vector<std::string>& names,
+	const std::string& api_key, LabelStore& store, const Options& options, LabelCache* cache,
+	std::vector<std::string>* failed = nullptr);
+
+// assumptions:
+//	path: valid path in the working directory that contains jpeg images grouped by directories
+//	api_key: valid gcp vision api key
+//	store: receives the labels of every directory
+//	options: upload settings passed on to prepare_upload and request settings passed on to batch_requests
+//		and make_requests
+//	cache: label cache or nullptr, see label_encodings
+//	base: path holds base images, uploaded by prepare_base_upload instead of prepare_upload
+// outcome: images in path are labeled and merged into store, returns the number of requests given up on
+size_t label_images(const std::filesystem::path& path, const std::string& api_key,
+	LabelStore& store, const Options& options, LabelCache* cache, bool base);
+
+// outcome: returns the file write_json writes the labels of directory to
+std::string json_path(const std::filesystem::path& path, const std::string& directory, const std::string& name);
+
+// outcome: returns the files save_labels writes the labels of directory to
+std::vector<std::string> label_files(const std::filesystem::path& path, const std::string& directory, const Options& options);
+
+// outcome: returns labels as a json array of objects with their description, max score, mean score and image count
+web::json::value label_json(const std::vector<std::pair<std::string, LabelStats>>& labels);
+
+// assumptions:
+//	path: valid path in working directory
+//	store: labels of every directory
+//	name: non-empty string
+//	sink: writes the files in the background, nullptr writes them before returning
+// outcome: labels of every directory with their max score, mean score and image count written to disk specified by path
+void write_json(const std::filesystem::path& path, const LabelStore& store, const std::string name,
+	OutputSink* sink = nullptr);
+
+// assumptions:
+//	path: output directory of the json files
+//	store: labels of every directory
+//	name: set the labels are stored under, ex base_labels
+//	sink: writes the json files in the background, nullptr writes them before returning
+//	index: label index or nullptr
+// outcome: labels of every image and segment appended to index as one chunk under its directory, and the
+//	directory statistics written as json files by write_json
+//	when options.json_labels
+void save_labels(const std::filesystem::path& path, const LabelStore& store, const std::string& name, const Options& options,
+	OutputSink* sink, LabelIndex* index);
@@ -0,0 +1,591 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <utility>
+#include <vector>
+
+// simd: sse2 on every x64 build, avx2 picked at runtime on cpus that support it, scalar otherwise
+#if defined(_M_X64) || defined(__SSE2__)
+#include <immintrin.h>
+#define PIXEL_KMEANS_SSE2
+#if defined(_MSC_VER)
+#define PIXEL_KMEANS_TARGET(isa)
+#else
+#define PIXEL_KMEANS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "pixel_kmeans.h"
+#include "simd.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+const size_t BLOCK_SIZE = 256;
+const size_t MIN_STRIPE_SIZE = 1 << 14;
+
+namespace
+{
+	// per stripe results of an assignment pass, reduced once the pass is done
+	//	farthest: min heap of the squared distance and index of the up to clusters pixels farthest from their
+	//		centers, so every cluster that ends up empty can be reseeded from a different one
+	struct Partial
+	{
+		vector<double> sums;
+		vector<double> counts;
+		double compactness = 0;
+		vector<pair<float, size_t>> farthest;
+		size_t farthest_limit = 0;
+
+		void reset(int clusters, int channels)
+		{
+			sums.assign(static_cast<size_t>(clusters) * channels, 0);
+			counts.assign(clusters, 0);
+			compactness = 0;
+			farthest.clear();
+			farthest_limit = static_cast<size_t>(clusters);
+		}
+
+		// outcome: pixel index kept when it is among the farthest seen so far
+		void offer(float distance, size_t index)
+		{
+			if (farthest.size() == farthest_limit)
+			{
+				if (distance <= farthest.front().first) return;
+				pop_heap(farthest.begin(), farthest.end(), greater<pair<float, size_t>>());
+				farthest.pop_back();
+			}
+			farthest.push_back({ distance, index });
+			push_heap(farthest.begin(), farthest.end(), greater<pair<float, size_t>>());
+		}
+	};
+
+	// outcome: number of stripes a pass over count pixels is split into
+	int stripe_count(size_t count)
+	{
+		const size_t stripes = max<size_t>(1, count / MIN_STRIPE_SIZE);
+		return static_cast<int>(min<size_t>(stripes, static_cast<size_t>(max(getNumThreads(), 1)) * 4));
+	}
+
+	// assumptions:
+	//	points: count pixels of CHANNELS values
+	//	centers: clusters rows of CHANNELS values
+	// outcome: labels and distances hold the nearest center of every pixel and its squared distance
+	template <int CHANNELS>
+	void assign_scalar(const float* points, size_t count, const float* centers, int clusters,
+		int* labels, float* distances)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* point = points + i * CHANNELS;
+			float best = FLT_MAX;
+			int best_label = 0;
+
+			for (int k = 0; k < clusters; k++)
+			{
+				const float* center = centers + k * CHANNELS;
+				float distance = 0;
+
+				for (int c = 0; c < CHANNELS; c++)
+				{
+					const float d = point[c] - center[c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					best_label = k;
+				}
+			}
+			labels[i] = best_label;
+			distances[i] = best;
+		}
+	}
+
+	template <int CHANNELS>
+	void assign_block(const float* points, size_t count, const float* centers, int clusters,
+		int* labels, float* distances)
+	{
+		assign_scalar<CHANNELS>(points, count, centers, clusters, labels, distances);
+	}
+
+#if defined(PIXEL_KMEANS_SSE2)
+	// outcome: labels and distances of the leading multiple of 8 pixels, returns the number of pixels assigned
+	PIXEL_KMEANS_TARGET("avx2")
+	size_t assign_avx2(const float* points, size_t count, const float* centers, int clusters, int* labels, float* distances)
+	{
+		size_t i = 0;
+
+		// 8 interleaved pixels are split into x, y and z vectors with two blends and a permute each
+		const __m256i x_order = _mm256_setr_epi32(0, 3, 6, 1, 4, 7, 2, 5);
+		const __m256i y_order = _mm256_setr_epi32(1, 4, 7, 2, 5, 0, 3, 6);
+		const __m256i z_order = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+
+		for (; i + 8 <= count; i += 8)
+		{
+			const float* p = points + i * 3;
+			const __m256 v0 = _mm256_loadu_ps(p);
+			const __m256 v1 = _mm256_loadu_ps(p + 8);
+			const __m256 v2 = _mm256_loadu_ps(p + 16);
+			const __m256 x = _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(v0, v1, 0x92), v2, 0x24), x_order);
+			const __m256 y = _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(v0, v1, 0x24), v2, 0x49), y_order);
+			const __m256 z = _mm256_permutevar8x32_ps(_mm256_blend_ps(_mm256_blend_ps(v0, v1, 0x49), v2, 0x92), z_order);
+
+			__m256 best = _mm256_set1_ps(FLT_MAX);
+			__m256 best_label = _mm256_castsi256_ps(_mm256_setzero_si256());
+
+			for (int k = 0; k < clusters; k++)
+			{
+				const __m256 dx = _mm256_sub_ps(x, _mm256_set1_ps(centers[k * 3]));
+				const __m256 dy = _mm256_sub_ps(y, _mm256_set1_ps(centers[k * 3 + 1]));
+				const __m256 dz = _mm256_sub_ps(z, _mm256_set1_ps(centers[k * 3 + 2]));
+				const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+					_mm256_mul_ps(dz, dz));
+				const __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+
+				best = _mm256_blendv_ps(best, distance, closer);
+				best_label = _mm256_blendv_ps(best_label, _mm256_castsi256_ps(_mm256_set1_epi32(k)), closer);
+			}
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + i), _mm256_castps_si256(best_label));
+			_mm256_storeu_ps(distances + i, best);
+		}
+		return i;
+	}
+
+	// outcome: labels and distances of the leading multiple of 4 pixels, returns the number of pixels assigned
+	size_t assign_sse2(const float* points, size_t count, const float* centers, int clusters, int* labels, float* distances)
+	{
+		size_t i = 0;
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const float* p = points + i * 3;
+			const __m128 x = _mm_setr_ps(p[0], p[3], p[6], p[9]);
+			const __m128 y = _mm_setr_ps(p[1], p[4], p[7], p[10]);
+			const __m128 z = _mm_setr_ps(p[2], p[5], p[8], p[11]);
+
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i best_label = _mm_setzero_si128();
+
+			for (int k = 0; k < clusters; k++)
+			{
+				const __m128 dx = _mm_sub_ps(x, _mm_set1_ps(centers[k * 3]));
+				const __m128 dy = _mm_sub_ps(y, _mm_set1_ps(centers[k * 3 + 1]));
+				const __m128 dz = _mm_sub_ps(z, _mm_set1_ps(centers[k * 3 + 2]));
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+
+				best = _mm_min_ps(distance, best);
+				best_label = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, best_label));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + i), best_label);
+			_mm_storeu_ps(distances + i, best);
+		}
+		return i;
+	}
+#endif
+
+	// 3 channel pixels are compared against one center per instruction, several pixels wide
+	template <>
+	void assign_block<3>(const float* points, size_t count, const float* centers, int clusters,
+		int* labels, float* distances)
+	{
+		size_t i = 0;
+
+#if defined(PIXEL_KMEANS_SSE2)
+		i = simd_level() >= SIMD_AVX2 ? assign_avx2(points, count, centers, clusters, labels, distances)
+			: assign_sse2(points, count, centers, clusters, labels, distances);
+#endif
+
+		assign_scalar<3>(points + i * 3, count - i, centers, clusters, labels + i, distances + i);
+	}
+
+	// outcome: weight of point i, every point counts once without weights
+	inline float weight_of(const float* weights, size_t i)
+	{
+		return weights ? weights[i] : 1.0f;
+	}
+
+	// assumptions:
+	//	points: count pixels of CHANNELS values
+	//	weights: count pixel weights or nullptr
+	//	centers: clusters rows of CHANNELS values
+	//	partials: one entry per stripe the pass is split into
+	// outcome: labels holds the nearest center of every pixel and every partial holds the weighted sums,
+	//	counts and compactness of its stripe, assignment and accumulation share one read of the pixels
+	template <int CHANNELS>
+	void assign_pass(const float* points, const float* weights, size_t count, const vector<float>& centers, int clusters,
+		int* labels, vector<Partial>& partials)
+	{
+		const int stripes = static_cast<int>(partials.size());
+
+		parallel_for_(Range(0, stripes), [&](const Range& range)
+		{
+			float distances[BLOCK_SIZE];
+
+			for (int stripe = range.start; stripe < range.end; stripe++)
+			{
+				Partial& partial = partials[stripe];
+				partial.reset(clusters, CHANNELS);
+
+				const size_t begin = count * stripe / stripes;
+				const size_t end = count * (stripe + 1) / stripes;
+
+				for (size_t block = begin; block < end; block += BLOCK_SIZE)
+				{
+					const size_t size = min(BLOCK_SIZE, end - block);
+					assign_block<CHANNELS>(points + block * CHANNELS, size, centers.data(), clusters, labels + block, distances);
+
+					for (size_t i = 0; i < size; i++)
+					{
+						const float* point = points + (block + i) * CHANNELS;
+						const float weight = weight_of(weights, block + i);
+						const int label = labels[block + i];
+						double* sum = partial.sums.data() + static_cast<size_t>(label) * CHANNELS;
+
+						for (int c = 0; c < CHANNELS; c++) sum[c] += static_cast<double>(weight) * point[c];
+						partial.counts[label] += weight;
+						partial.compactness += static_cast<double>(weight) * distances[i];
+
+						partial.offer(distances[i], block + i);
+					}
+				}
+			}
+		}, stripes);
+	}
+
+	// assumptions: partials hold a finished assignment pass over points using centers
+	// outcome: next holds the mean of every cluster, empty clusters take the farthest pixels first one after
+	//	another, each candidate measured against its own center and every center reseeded before it so no two
+	//	empty clusters take the same point, compactness holds the total of the pass and the largest squared
+	//	center shift is returned
+	template <int CHANNELS>
+	double update_centers(const float* points, const vector<Partial>& partials, const vector<float>& centers,
+		int clusters, vector<float>& next, double& compactness)
+	{
+		vector<double> sums(static_cast<size_t>(clusters) * CHANNELS, 0);
+		vector<double> counts(clusters, 0);
+		vector<pair<float, size_t>> candidates;
+
+		compactness = 0;
+		for (const auto& partial: partials)
+		{
+			for (size_t i = 0; i < sums.size(); i++) sums[i] += partial.sums[i];
+			for (int k = 0; k < clusters; k++) counts[k] += partial.counts[k];
+			compactness += partial.compactness;
+			candidates.insert(candidates.end(), partial.farthest.begin(), partial.farthest.end());
+		}
+
+		double shift = 0;
+		next.resize(centers.size());
+
+		for (int k = 0; k < clusters; k++)
+		{
+			float* center = next.data() + static_cast<size_t>(k) * CHANNELS;
+
+			if (counts[k] == 0 && !candidates.empty())
+			{
+				auto chosen = max_element(candidates.begin(), candidates.end());
+				memcpy(center, points + chosen->second * CHANNELS, sizeof(float) * CHANNELS);
+
+				// candidates close to the new center are no longer far from every center
+				*chosen = candidates.back();
+				candidates.pop_back();
+				for (auto& candidate: candidates)
+				{
+					const float* point = points + candidate.second * CHANNELS;
+					float distance = 0;
+					for (int c = 0; c < CHANNELS; c++) distance += (point[c] - center[c]) * (point[c] - center[c]);
+					candidate.first = min(candidate.first, distance);
+				}
+			}
+			else if (counts[k] == 0) memcpy(center, centers.data() + static_cast<size_t>(k) * CHANNELS, sizeof(float) * CHANNELS);
+			else for (int c = 0; c < CHANNELS; c++) center[c] = static_cast<float>(sums[k * CHANNELS + c] / counts[k]);
+
+			double distance = 0;
+			for (int c = 0; c < CHANNELS; c++)
+			{
+				const double d = static_cast<double>(center[c]) - centers[k * CHANNELS + c];
+				distance += d * d;
+			}
+			shift = max(shift, distance);
+		}
+		return shift;
+	}
+
+	// assumptions: cumulative: running total of the point weights, empty without weights
+	// outcome: returns a random point index, drawn with probability proportional to its weight
+	size_t draw(const vector<double>& cumulative, size_t count, RNG& rng)
+	{
+		if (cumulative.empty()) return min(count - 1, static_cast<size_t>(rng.uniform(0.0, 1.0) * count));
+
+		const double target = rng.uniform(0.0, 1.0) * cumulative.back();
+		return min(count - 1, static_cast<size_t>(upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin()));
+	}
+
+	// outcome: returns the running total of weights, empty without weights
+	vector<double> cumulative_weights(const float* weights, size_t count)
+	{
+		vector<double> cumulative;
+		if (!weights) return cumulative;
+
+		cumulative.resize(count);
+		double total = 0;
+		for (size_t i = 0; i < count; i++) cumulative[i] = total += weights[i];
+
+		return cumulative;
+	}
+
+	// outcome: centers holds clusters distinct random pixels, drawn by weight
+	template <int CHANNELS>
+	void seed_random(const float* points, const vector<double>& cumulative, size_t count, int clusters, RNG& rng,
+		vector<float>& centers)
+	{
+		vector<size_t> chosen;
+
+		while (chosen.size() < static_cast<size_t>(clusters))
+		{
+			const size_t index = draw(cumulative, count, rng);
+			if (count < static_cast<size_t>(clusters) * 2 || find(chosen.begin(), chosen.end(), index) == chosen.end())
+				chosen.push_back(index);
+		}
+		for (int k = 0; k < clusters; k++)
+			memcpy(centers.data() + static_cast<size_t>(k) * CHANNELS, points + chosen[k] * CHANNELS, sizeof(float) * CHANNELS);
+	}
+
+	// outcome: centers picked by k-means++, every pick is a pixel sampled with probability proportional
+	//	to its weight times its squared distance from the nearest center picked so far
+	template <int CHANNELS>
+	void seed_plus_plus(const float* points, const float* weights, const vector<double>& cumulative, size_t count,
+		int clusters, RNG& rng, vector<float>& centers)
+	{
+		const int stripes = stripe_count(count);
+		vector<float> nearest(count, FLT_MAX);
+		vector<double> totals(stripes);
+
+		size_t chosen = draw(cumulative, count, rng);
+		memcpy(centers.data(), points + chosen * CHANNELS, sizeof(float) * CHANNELS);
+
+		for (int k = 1; k < clusters; k++)
+		{
+			const float* center = centers.data() + static_cast<size_t>(k - 1) * CHANNELS;
+
+			parallel_for_(Range(0, stripes), [&](const Range& range)
+			{
+				for (int stripe = range.start; stripe < range.end; stripe++)
+				{
+					double total = 0;
+
+					for (size_t i = count * stripe / stripes; i < count * (stripe + 1) / stripes; i++)
+					{
+						float distance = 0;
+						for (int c = 0; c < CHANNELS; c++)
+						{
+							const float d = points[i * CHANNELS + c] - center[c];
+							distance += d * d;
+						}
+						nearest[i] = min(nearest[i], distance);
+						total += static_cast<double>(weight_of(weights, i)) * nearest[i];
+					}
+					totals[stripe] = total;
+				}
+			}, stripes);
+
+			// walk the stripe totals first so only one stripe is scanned
+			double target = 0;
+			for (const auto& total: totals) target += total;
+			target *= rng.uniform(0.0, 1.0);
+
+			int stripe = 0;
+			while (stripe < stripes - 1 && target >= totals[stripe]) target -= totals[stripe++];
+
+			const size_t end = count * (stripe + 1) / stripes;
+			chosen = end - 1;
+			for (size_t i = count * stripe / stripes; i < end; i++)
+			{
+				target -= static_cast<double>(weight_of(weights, i)) * nearest[i];
+				if (target < 0)
+				{
+					chosen = i;
+					break;
+				}
+			}
+			memcpy(centers.data() + static_cast<size_t>(k) * CHANNELS, points + chosen * CHANNELS, sizeof(float) * CHANNELS);
+		}
+	}
+
+	// outcome: centers refined with mini-batch k-means, each iteration moves the centers towards a random
+	//	sample of batch_size pixels drawn by weight with a per center learning rate of 1 / (pixels seen)
+	template <int CHANNELS>
+	void refine_mini_batch(const float* points, const vector<double>& cumulative, size_t count, int clusters,
+		int batch_size, int max_iter, double epsilon, RNG& rng, vector<float>& centers)
+	{
+		vector<float> batch(static_cast<size_t>(batch_size) * CHANNELS), distances(batch_size), previous;
+		vector<int> labels(batch_size);
+		vector<double> seen(clusters, 0);
+
+		for (int iter = 0; iter < max_iter; iter++)
+		{
+			previous = centers;
+
+			for (int i = 0; i < batch_size; i++)
+			{
+				const size_t index = draw(cumulative, count, rng);
+				memcpy(batch.data() + static_cast<size_t>(i) * CHANNELS, points + index * CHANNELS, sizeof(float) * CHANNELS);
+			}
+			assign_block<CHANNELS>(batch.data(), batch_size, centers.data(), clusters, labels.data(), distances.data());
+
+			for (int i = 0; i < batch_size; i++)
+			{
+				float* center = centers.data() + static_cast<size_t>(labels[i]) * CHANNELS;
+				const double rate = 1.0 / ++seen[labels[i]];
+
+				for (int c = 0; c < CHANNELS; c++)
+					center[c] += static_cast<float>(rate * (batch[static_cast<size_t>(i) * CHANNELS + c] - center[c]));
+			}
+
+			double shift = 0;
+			for (int k = 0; k < clusters; k++)
+			{
+				double distance = 0;
+				for (int c = 0; c < CHANNELS; c++)
+				{
+					const double d = static_cast<double>(centers[k * CHANNELS + c]) - previous[k * CHANNELS + c];
+					distance += d * d;
+				}
+				shift = max(shift, distance);
+			}
+			if (shift <= epsilon) break;
+		}
+	}
+}
+
+// assumptions:
+//	CHANNELS: number of float values per pixel, known at compile time
+//	data: continuous CV_32F matrix holding CHANNELS values per pixel (N x CHANNELS or N x 1 with CHANNELS channels)
+//	weights: empty, or continuous CV_32F matrix with one positive weight per pixel
+//	clusters: number of clusters in [1, N]
+//	criteria: max iterations and center shift epsilon, handled like cv::kmeans
+//	attempts: number of restarts, the most compact result is kept
+//	centers: with KMeansSeeding::INITIAL, CV_32F clusters x CHANNELS matrix the only attempt starts from
+// outcome:
+//	labels: CV_32S N x 1 matrix with the cluster of every pixel
+//	centers: CV_32F clusters x CHANNELS matrix of weighted cluster centers
+//	returns the weighted compactness (sum of weighted squared distances to the centers)
+template <int CHANNELS>
+double pixel_kmeans(const Mat& data, const Mat& weights, int clusters, Mat& labels, TermCriteria criteria, int attempts,
+	const KMeansOptions& options, Mat& centers)
+{
+	CV_Assert(data.depth() == CV_32F && data.isContinuous());
+	CV_Assert((data.total() * data.channels()) % CHANNELS == 0);
+
+	const size_t count = data.total() * data.channels() / CHANNELS;
+	const float* points = data.ptr<float>();
+
+	CV_Assert(clusters >= 1 && static_cast<size_t>(clusters) <= count);
+	CV_Assert(weights.empty() || (weights.type() == CV_32F && weights.isContinuous() && weights.total() == count));
+
+	const float* point_weights = weights.empty() ? nullptr : weights.ptr<float>();
+	const vector<double> cumulative = cumulative_weights(point_weights, count);
+
+	// same defaults and limits as cv::kmeans
+	double epsilon = (criteria.type & TermCriteria::EPS) ? max(criteria.epsilon, 0.0) : FLT_EPSILON;
+	epsilon *= epsilon;
+	const int max_iter = (criteria.type & TermCriteria::COUNT) ? min(max(criteria.maxCount, 2), 100) : 100;
+
+	// unseeded runs still get a generator of their own, theRNG is shared with everything else on the thread
+	RNG rng(options.seed != 0 ? options.seed : static_cast<uint64_t>(random_device{}()) << 32 | random_device{}());
+	vector<Partial> partials(stripe_count(count));
+	vector<float> current(static_cast<size_t>(clusters) * CHANNELS), next, best_centers;
+	Mat best_labels(static_cast<int>(count), 1, CV_32S), scratch(static_cast<int>(count), 1, CV_32S);
+	double best_compactness = DBL_MAX;
+
+	// warm starts refine the given centers once instead of restarting from random ones
+	vector<float> initial;
+	if (options.seeding == KMeansSeeding::INITIAL)
+	{
+		CV_Assert(centers.type() == CV_32F && centers.total() == current.size());
+		Mat continuous = centers.isContinuous() ? centers : centers.clone();
+		initial.assign(continuous.ptr<float>(), continuous.ptr<float>() + current.size());
+		attempts = 1;
+	}
+
+	for (int attempt = 0; attempt < max(attempts, 1); attempt++)
+	{
+		TraceScope trace("kmeans_attempt", count * CHANNELS * sizeof(float));
+
+		if (options.seeding == KMeansSeeding::INITIAL) current = initial;
+		else if (options.seeding == KMeansSeeding::PLUS_PLUS)
+			seed_plus_plus<CHANNELS>(points, point_weights, cumulative, count, clusters, rng, current);
+		else seed_random<CHANNELS>(points, cumulative, count, clusters, rng, current);
+
+		if (options.batch_size > 0)
+			refine_mini_batch<CHANNELS>(points, cumulative, count, clusters, options.batch_size, max_iter, epsilon, rng, current);
+
+		// labels always belong to the centers they were assigned with, like cv::kmeans
+		double compactness = 0;
+		for (int iter = 0; ; iter++)
+		{
+			assign_pass<CHANNELS>(points, point_weights, count, current, clusters, scratch.ptr<int>(), partials);
+			const double shift = update_centers<CHANNELS>(points, partials, current, clusters, next, compactness);
+
+			if (options.batch_size > 0 || iter + 1 >= max_iter || shift <= epsilon) break;
+			current.swap(next);
+		}
+
+		if (compactness < best_compactness)
+		{
+			best_compactness = compactness;
+			best_centers = current;
+			swap(best_labels, scratch);
+		}
+	}
+
+	labels = best_labels;
+	centers.create(clusters, CHANNELS, CV_32F);
+	memcpy(centers.ptr<float>(), best_centers.data(), sizeof(float) * best_centers.size());
+
+	return best_compactness;
+}
+
+// outcome: pixel_kmeans with every pixel weighted once
+template <int CHANNELS>
+double pixel_kmeans(const Mat& data, int clusters, Mat& labels, TermCriteria criteria, int attempts,
+	const KMeansOptions& options, Mat& centers)
+{
+	return pixel_kmeans<CHANNELS>(data, Mat(), clusters, labels, criteria, attempts, options, centers);
+}
+
+template double pixel_kmeans<3>(const Mat& data, const Mat& weights, int clusters, Mat& labels, TermCriteria criteria,
+	int attempts, const KMeansOptions& options, Mat& centers);
+template double pixel_kmeans<3>(const Mat& data, int clusters, Mat& labels, TermCriteria criteria, int attempts,
+	const KMeansOptions& options, Mat& centers);
+
+// assumptions:
+//	points: count pixels of CHANNELS float values
+//	centers: clusters rows of CHANNELS float values
+//	labels, distances: room for count values each
+// outcome: labels and distances hold the nearest center of every pixel and its squared distance,
+//	every pixel is assigned on its own so the result never depends on how the pixels are split up
+template <int CHANNELS>
+void pixel_assign(const float* points, size_t count, const float* centers, int clusters, int* labels, float* distances)
+{
+	assign_block<CHANNELS>(points, count, centers, clusters, labels, distances);
+}
+
+template void pixel_assign<3>(const float* points, size_t count, const float* centers, int clusters, int* labels,
+	float* distances);
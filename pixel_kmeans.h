@@ -0,0 +1,55 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// how the initial centers of each attempt are picked, INITIAL starts a single attempt from the centers passed in
+enum class KMeansSeeding { RANDOM, PLUS_PLUS, INITIAL };
+
+struct KMeansOptions
+{
+	KMeansSeeding seeding = KMeansSeeding::PLUS_PLUS;
+
+	// pixels sampled per iteration in mini-batch mode, 0 runs full lloyd iterations
+	int batch_size = 0;
+
+	// seed of the random generator, 0 seeds it from std::random_device so runs differ
+	uint64_t seed = 0;
+};
+
+// assumptions:
+//	CHANNELS: number of float values per pixel, known at compile time
+//	data: continuous CV_32F matrix holding CHANNELS values per pixel (N x CHANNELS or N x 1 with CHANNELS channels)
+//	clusters: number of clusters in [1, N]
+//	criteria: max iterations and center shift epsilon, handled like cv::kmeans
+//	attempts: number of restarts, the most compact result is kept
+//	centers: with KMeansSeeding::INITIAL, CV_32F clusters x CHANNELS matrix the only attempt starts from
+// outcome:
+//	labels: CV_32S N x 1 matrix with the cluster of every pixel
+//	centers: CV_32F clusters x CHANNELS matrix of cluster centers
+//	returns the compactness (sum of squared distances to the centers) like cv::kmeans
+template <int CHANNELS>
+double pixel_kmeans(const cv::Mat& data, int clusters, cv::Mat& labels, cv::TermCriteria criteria, int attempts,
+	const KMeansOptions& options, cv::Mat& centers);
+
+// assumptions: weights: empty, or continuous CV_32F matrix with one positive weight per pixel of data
+// outcome: pixel_kmeans where every pixel counts weight times, in the centers, the seeding and the compactness
+template <int CHANNELS>
+double pixel_kmeans(const cv::Mat& data, const cv::Mat& weights, int clusters, cv::Mat& labels, cv::TermCriteria criteria,
+	int attempts, const KMeansOptions& options, cv::Mat& centers);
+
+// assumptions:
+//	points: count pixels of CHANNELS float values
+//	centers: clusters rows of CHANNELS float values
+//	labels, distances: room for count values each
+// outcome: labels and distances hold the nearest center of every pixel and its squared distance,
+//	every pixel is assigned on its own so the result never depends on how the pixels are split up
+template <int CHANNELS>
+void pixel_assign(const float* points, size_t count, const float* centers, int clusters, int* labels, float* distances);
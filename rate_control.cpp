@@ -0,0 +1,85 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+// custom
+#include "rate_control.h"
+
+// namespaces
+using namespace std;
+
+// assumptions:
+//	rate: requests per second, 0 or less never limits
+//	burst: requests that may go at once after an idle period, at least 1
+TokenBucket::TokenBucket(double rate, double burst)
+	: rate(rate), burst(max(burst, 1.0)), tokens(max(burst, 1.0)), refilled(chrono::steady_clock::now())
+{
+}
+
+// outcome: returns how long to wait before a token is free, zero when one is taken
+chrono::milliseconds TokenBucket::take()
+{
+	if (rate <= 0) return chrono::milliseconds(0);
+
+	const auto now = chrono::steady_clock::now();
+	tokens = min(burst, tokens + chrono::duration<double>(now - refilled).count() * rate);
+	refilled = now;
+
+	if (tokens >= 1)
+	{
+		tokens -= 1;
+		return chrono::milliseconds(0);
+	}
+
+	return chrono::milliseconds(static_cast<long long>(ceil((1 - tokens) / rate * 1000)));
+}
+
+// assumptions: maximum: upper bound of the limit, the limit starts there
+AimdWindow::AimdWindow(size_t maximum)
+	: maximum(max<size_t>(maximum, 1)), window(static_cast<double>(max<size_t>(maximum, 1))), since_decrease(max<size_t>(maximum, 1))
+{
+}
+
+// outcome: current limit, in [1, maximum]
+size_t AimdWindow::limit() const
+{
+	return static_cast<size_t>(window);
+}
+
+// outcome: a successful request counted towards the next increase
+void AimdWindow::success()
+{
+	// one more request per window of successes, additive in round trips like tcp congestion avoidance
+	window = min(static_cast<double>(maximum), window + 1 / window);
+	since_decrease++;
+}
+
+// outcome: limit halved, at most once per window of requests so a burst of rejections counts once
+void AimdWindow::throttled()
+{
+	// requests already in flight when the limit dropped report the same congestion
+	if (since_decrease < limit())
+	{
+		since_decrease++;
+		return;
+	}
+
+	window = max(1.0, floor(window / 2));
+	since_decrease = 0;
+}
+
+// assumptions:
+//	attempt: retries made so far, starting at 0
+//	jitter: generator owned by the caller's limiter, seeded apart from every other one
+// outcome: returns a full jitter exponential backoff, uniform in [0, min(cap, base * 2^attempt)]
+chrono::milliseconds backoff(int attempt, chrono::milliseconds base, chrono::milliseconds cap, mt19937& jitter)
+{
+	const double ceiling = min(static_cast<double>(cap.count()), base.count() * pow(2.0, min(attempt, 30)));
+	return chrono::milliseconds(static_cast<long long>(uniform_real_distribution<double>(0.0, ceiling)(jitter)));
+}
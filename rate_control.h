@@ -0,0 +1,62 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <chrono>
+#include <cstddef>
+#include <random>
+
+// token bucket limiting requests to rate per second with bursts of up to burst requests
+class TokenBucket
+{
+public:
+	// assumptions:
+	//	rate: requests per second, 0 or less never limits
+	//	burst: requests that may go at once after an idle period, at least 1
+	TokenBucket(double rate, double burst);
+
+	// outcome: returns how long to wait before a token is free, zero when one is taken
+	std::chrono::milliseconds take();
+
+private:
+	double rate;
+	double burst;
+	double tokens;
+	std::chrono::steady_clock::time_point refilled;
+};
+
+// additive increase, multiplicative decrease limit of requests in flight
+//	the limit grows by one once a full window of requests succeeded and halves on throttling,
+//	so it settles just under the concurrency the endpoint accepts
+class AimdWindow
+{
+public:
+	// assumptions: maximum: upper bound of the limit, the limit starts there
+	AimdWindow(size_t maximum);
+
+	// outcome: current limit, in [1, maximum]
+	size_t limit() const;
+
+	// outcome: a successful request counted towards the next increase
+	void success();
+
+	// outcome: limit halved, at most once per window of requests so a burst of rejections counts once
+	void throttled();
+
+private:
+	size_t maximum;
+	double window;
+
+	// requests completed since the last decrease
+	size_t since_decrease;
+};
+
+// assumptions:
+//	attempt: retries made so far, starting at 0
+//	jitter: generator owned by the caller's limiter, seeded apart from every other one
+// outcome: returns a full jitter exponential backoff, uniform in [0, min(cap, base * 2^attempt)]
+std::chrono::milliseconds backoff(int attempt, std::chrono::milliseconds base, std::chrono::milliseconds cap,
+	std::mt19937& jitter);
@@ -16,21 +16,17 @@
 //			C/C++ > General > Additional Include Directories
 //			Linker > General > Additional Library Directories
 
-// codecvt deprecated in c++17 and up but std committee will not be removing codecvt for the 
-// foreseable future until a replacement is standardized
-// source: https://stackoverflow.com/questions/2573834/c-convert-string-or-char-to-wstring-or-wchar-t
-#define _SILENCE_CXX17_CODECVT_HEADER_DEPRECATION_WARNING
-
 // std
 #include <algorithm>
-#include <codecvt>
+#include <chrono>
 #include <filesystem>
-#include <fstream>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
-#include <sstream>
 #include <string>
+#include <vector>
 
 #include <direct.h>
 #include <stdio.h>
@@ -38,380 +34,280 @@
 // opencv
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
-#include <opencv2/imgproc.hpp>
-
-// vcpkg
-#include <cpprest/http_client.h>
-#include <cpprest/json.h>
-#include <cpprest/uri.h>
 
 // custom
-#include "base64.h"
+#include "batch.h"
+#include "grabcut.h"
+#include "label_cache.h"
+#include "label_index.h"
+#include "label_store.h"
+#include "manifest.h"
+#include "mock_vision.h"
+#include "options.h"
+#include "output_sink.h"
+#include "pipeline.h"
+#include "segments.h"
+#include "service.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 // namespaces
 using namespace cv;
 using namespace std;
-using namespace web;
 
 // global constants
 const filesystem::path INPUT_PATH("images");
 const filesystem::path OUTPUT_PATH("output");
 const filesystem::path SEGMENT_PATH("segments");
-const double EPSILON = 1.0;
-const int ATTEMPTS = 2;
-const int ITER = 10;
-
-// global variables
-wstring_convert<codecvt_utf8_utf16<wchar_t>> converter;
 
 // assumptions:
-//	img: valid image matrix in opencv
-//	rectangle: rectangle are smaller than img window 
-// outcome: outputing image with grabcuts segments  
-Mat _grabCut(const Mat& img, Rect rectangle) {
-	//initializing the matrix for grabcut
-	Mat results;
-	Mat background_m, foreground_m;
-
-	//grab cut
-	grabCut(img, results, rectangle, background_m, foreground_m, 1, GC_INIT_WITH_RECT);
-	compare(results, GC_PR_FGD, results, CMP_EQ);
-
-	//making the foreground objects 
-	Mat foreground(img.size(), CV_8UC3, Scalar(0, 0, 0));
-	img.copyTo(foreground, results);
-
-	return foreground;
-}
-
-// assumptions:
-//	input: valid image file loaded in opencv
-//  file_dir: correct directory of the image 
-//	cluster_size: integer values: [2-20]
-// outcome: outputing the image into segments and write to disk
-void segmentation(Mat& input, const string& file_dir, const int& cluster_size) {
-	//read in the image and make a copy
-	Mat img = input.clone();
-	// convert image pixel to float & reshape to a [3 x W*H] Mat 
-	//  (so every pixel is on a row of it's own)
-	Mat data;
-	img.convertTo(data, CV_32F);
-	data = data.reshape(1, static_cast<int>(data.total()));
-	
-	// do kmeans
-	Mat labels, centers;
-	int clusters = cluster_size;
-	kmeans(data, clusters, labels, TermCriteria(TermCriteria::EPS + TermCriteria::MAX_ITER, ITER, EPSILON), ATTEMPTS,
-		KMEANS_RANDOM_CENTERS, centers);
-
-	// reshape labels and cluster centers to a single row of Vec3f pixels
-	centers = centers.reshape(3, centers.rows);
-	data = data.reshape(3, data.rows);
-
-	//for each cluster, outputing the segments 
-	for (int center_id = 0; center_id < clusters; center_id++) {
-		Mat temp = data.clone();
-		Vec3f* pointer = temp.ptr<Vec3f>();
-		for (int i = 0; i < temp.rows; i++) {
-			if (center_id == labels.at<int>(i)) {
-				//pointer[i] = centers.at<Vec3f>(center_id);
-			}
-			else {
-				pointer[i] = Vec3f{ 0, 0, 0 };
-			}
-		}
-		string output_dir = format("./segments/%s/%s_kmean%d_%d.jpg", file_dir.c_str(), file_dir.c_str(), clusters, center_id);
-		temp = temp.reshape(3, img.rows);
-		temp.convertTo(temp, CV_8U);
-		imwrite(output_dir, temp);
-	}
-
-	// replace pixel values with their center value:
-	Vec3f* p = data.ptr<Vec3f>();
-	for (int i = 0; i < data.rows; i++) {
-		int center_id = labels.at<int>(i);
-		p[i] = centers.at<Vec3f>(center_id);
-	}
-
-	// back to 2d, and uchar:
-	img = data.reshape(3, img.rows);
-	img.convertTo(img, CV_8U);
-
-	//display the k mean result and output into the segment directory
-	//namedWindow("Original Image");
-	//imshow("Original Image", ocv);
-	imwrite(format("./segments/%s/%s_kmean%d_full.jpg", file_dir.c_str(), file_dir.c_str(), clusters), img);
-}
+//	argv[1]: valid api key for cloud vision api
+//	argv[2]: file name for input image that exists in images directory, with --batch a directory or manifest of images
+//	argv[3]: cluster size for kmeans algorithm [2-20]
+//	argv[4...]: optional --name=value settings, see parse_options, queries take only these
+// outcomes: 
+//	loads api key from disk
+//	segments input image
+//	labels all images in segments directory, only the image's own directories with a stage manifest
+//	appends labels to the label index, and writes them as json files to disk in output directory with --json-labels
+//	with --query-label or --query-image only answers the query from the label index
+//	skips the stages the stage manifest records as complete for the same image file and settings
+int main(int argc, char** argv)
+{	
+	int cluster_size = 0;
+	char key_buffer[256] = "", image_buffer[256] = "";
+	string arguments, api_key;
 
-// outcome: returns string converted from wstring
-string to_string(const wstring wide_string)
-{
-	return converter.to_bytes(wide_string);
-}
+	// optional settings start at the first --name=value argument, queries leave the positional arguments out
+	int positional = 1;
+	while (positional < min(argc, 4) && string(argv[positional]).rfind("--", 0) != 0) positional++;
 
-// outcome: returns wstring converted from string
-wstring to_wstring(const string normal_string)
-{
-	return converter.from_bytes(normal_string);
-}
+	// parse arguments
+	for_each(argv + 1, argv + positional, [&arguments](const char* c_str) { arguments += string(c_str) + " ";	});
+	sscanf_s(arguments.c_str(), "%s %s %d", key_buffer, static_cast<uint>(sizeof(key_buffer)), 
+		image_buffer, static_cast<uint>(sizeof(image_buffer)), &cluster_size);
+	
+	Options options;
+	parse_options(argc, argv, positional, options);
 
-// assuptions:
-//	file_name: is a valid file in the working directory that contains a
-//		working gcp api key for the vision api
-// outcome: api_key is stores a valid gcp api key or program exits if key cannot be read
-void load_key(const string& file_name, string& api_key)
-{
-	ifstream key_file(file_name);
+	// traced runs count every mat allocation from here on
+	if (!options.trace.empty()) trace_enable();
 
-	if (!getline(key_file, api_key))
+	// queries are answered from the label index alone, no key or image is needed
+	if (!options.query_label.empty() || !options.query_image.empty())
 	{
-		printf("load key failure\n");
-		exit(EXIT_FAILURE);
-	}
-}
+		if (options.label_index.empty())
+		{
+			printf("label index failure: --label-index is empty\n");
+			return EXIT_FAILURE;
+		}
 
-// assuptions:
-//	json_objects: properly initialized vector containing valid json::value
-//		objects that conform to the vision api request json schema 
-//	api_key: string that contains valid gcp vision api key
-//	group: properly initialized set 
-// outcome:
-//	group will be populated with all the label annotations associated with
-//		with the api responses
-void make_requests(const vector<json::value>& json_objects, const string& api_key, set<string>& group)
-{	
-	if (json_objects.empty()) return;
+		// a query never creates or rewrites the index, a mistyped path or another file is reported instead
+		LabelIndex index(options.label_index, true);
+		if (!index.is_open())
+		{
+			printf("label index failure:%s\n", options.label_index.c_str());
+			return EXIT_FAILURE;
+		}
 
-	string label;
+		const vector<LabelPosting> postings = options.query_label.empty() ? index.labels(options.query_image)
+			: index.find(options.query_label);
 
-	// setup uri
-	uri_builder uri_path(L"https://vision.googleapis.com/");
-	uri_path.append_path(L"v1/images:annotate");
-	uri_path.append_query(L"key", to_wstring(api_key));
-	
-	// setup api
-	http::client::http_client api(uri_path.to_uri());
-
-	for (const auto& json_object: json_objects)
-	{		
-		// setup request
-		http::http_request post(http::methods::POST);
-		post.set_body(json_object);
-		
-		// async request
-		pplx::task<void> async_chain = api.request(post)
-		
-		// handle http_response from api.request
-		.then([&group, &label](http::http_response response)
-		{	
-			json::value result = response.extract_json().get();
-
-			if (!result[L"responses"][0].as_object().size() == 0)
-				for (auto object : result[L"responses"][0][L"labelAnnotations"].as_array())
-				{	
-					label = to_string(object[L"description"].serialize());
-					label.erase(remove(label.begin(), label.end(), '\"'), label.end());
-					group.insert(label);
-				}
-		});
+		for (const auto& posting: postings)
+			printf("%s\t%s\t%s\t%s\t%.3f\t%.3f\t%u\n", posting.parent.c_str(), posting.name.c_str(), posting.set.c_str(),
+				posting.description.c_str(), posting.max_score, posting.mean_score, posting.count);
 
-		// wait for outstanding I/O
-		try { async_chain.wait(); }
-		catch (const exception& e) { printf("request exception:%s\n", e.what()); }
+		return EXIT_SUCCESS;
 	}
-}
-
-// assumptions:
-//	encodings: properly intialized vector of base64 encoded images
-//	json_objects: properly intialized vector
-// outcome: valid vision api requests created and stored in json_objects
-// improvements:
-//	trade constants for variables
-//	more resilient failure handling
-void generate_json(const vector<string>& encodings, vector<json::value>& json_objects)
-{	
-	if (encodings.empty()) return;
-
-	const size_t MAX_RESULTS = 50;
-	const wstring TYPE = L"LABEL_DETECTION";
-	const wstring MODEL = L"builtin/latest";
 
-	json::value requests;
+	// offline runs answer every request from a local mock endpoint instead of the vision api
+	unique_ptr<MockVisionServer> mock;
+	if (options.mock)
+	{
+		options.endpoint = format("http://localhost:%d/", options.mock_port);
+		mock = make_unique<MockVisionServer>(to_wstring(options.endpoint), chrono::milliseconds(options.mock_latency),
+			options.mock_fault_rate);
+	}
 
-	for (const auto& data: encodings)
-	{	
-		requests = json::value::object();
-		requests[L"requests"] = json::value::array();
+	// load api key or fail, the mock endpoint ignores it
+	if (options.mock) api_key = "mock";
+	else load_key(string(key_buffer), api_key);
 
-		requests[L"requests"][0] = json::value::object();		
-		requests[L"requests"][0][L"features"] = json::value::array();
+	// labels of images seen by earlier runs are served from disk
+	unique_ptr<LabelCache> cache;
+	if (!options.cache.empty()) cache = make_unique<LabelCache>(options.cache, options.cache_entries);
 
-		requests[L"requests"][0][L"features"][0] = json::value::object();
-		requests[L"requests"][0][L"features"][0][L"maxResults"] = json::value(MAX_RESULTS);
-		requests[L"requests"][0][L"features"][0][L"type"] = json::value(TYPE);
-		requests[L"requests"][0][L"features"][0][L"model"] = json::value(MODEL);
+	// segment images and label files are encoded and written in the background
+	OutputSink sink(options.output_threads, options.output_queue, options.output_codec, options.output_quality);
 
-		requests[L"requests"][0][L"image"] = json::value::object();
-		requests[L"requests"][0][L"image"][L"content"] = json::value(to_wstring(data));
-		
-		json_objects.push_back(requests);
-	}
-}
+	// stages finished by earlier runs are skipped when their inputs did not change
+	unique_ptr<StageManifest> manifest;
+	if (!options.stage_manifest.empty()) manifest = make_unique<StageManifest>(options.stage_manifest);
 
-// assumptions:
-//	path: valid path in the working directory that contains jpeg images grouped by directories
-//	api_key: valid gcp vision api key
-//	directory_labels: properly initialized map
-// outcome: images in path are labeled and stored in directory_labels
-// improvements:
-//	trade constant for variable
-//	more resilient failure handling
-void label_images(const filesystem::path& path, const string& api_key, map<string, set<string>>& directory_labels)
-{
-	const string EXTENSION = ".jpg";
-
-	Mat image;
-	vector<uchar> buffer;
-	vector<string> encodings;
-	vector<json::value> json_objects;
-	error_code e;
-	
-	// get first folder
-	auto directory = filesystem::recursive_directory_iterator(path);
-	string last_directory = directory->path().filename().string();
-	directory.increment(e);
+	// labels of every run are appended to one index instead of one json file per directory
+	unique_ptr<LabelIndex> index;
+	if (!options.label_index.empty()) index = make_unique<LabelIndex>(options.label_index);
 
-	// convert each jpeg image found in path to base64
-	for (const auto& entry: directory)
+	// service runs keep the key, cache, sink and annotate connections warm and take jobs until a line is entered
+	if (!options.serve.empty())
 	{
-		if (entry.is_directory())
+		size_t failures = 0;
 		{
-			generate_json(encodings, json_objects);
-			encodings.clear();
-
-			directory_labels[last_directory] = set<string>();
-			make_requests(json_objects, api_key, directory_labels[last_directory]);
-			json_objects.clear();
+			SegmentationService service(to_wstring(options.serve), api_key, cluster_size, options, cache.get(), sink);
+			printf("serving:%sjobs, press enter to stop\n", options.serve.c_str());
 
-			last_directory = entry.path().filename().string();
+			string line;
+			getline(cin, line);
+			printf("service: %zu jobs served, %zu failed\n", service.served(), service.failures());
+			failures = service.failures();
 		}
-		if (entry.is_regular_file())
-		{	
-			image = imread(entry.path().string());
-			buffer.resize(static_cast<size_t>(image.rows) * static_cast<size_t>(image.cols));
+		sink.flush();
 
-			if (imencode(EXTENSION, image, buffer)) encodings.push_back(base64_encode(buffer.data(), buffer.size()));
-			else printf("conversion failure\n");
-		}
-	}
-	
-	// identify any remaining images
-	if (!encodings.empty())
-	{
-		generate_json(encodings, json_objects);
-		encodings.clear();
+		if (cache) printf("label cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+		if (trace_enabled() && trace_export(options.trace)) trace_summary();
 
-		directory_labels[last_directory] = set<string>();
-		make_requests(json_objects, api_key, directory_labels[last_directory]);
-		json_objects.clear();
+		return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
-}
 
-// assumptions:
-//	path: valid path in working directory
-//	directory_labels: properly initialized map that contains string to set mappings of an image
-//	name: non-empty string
-// outcome: directory_label mappings written to disk specified by path
-void write_json(const filesystem::path& path, const map<string, set<string>>& directory_labels, const string name)
-{	
-	int index;
-	json::value data;
-
-	// each iteration of key is one json object to written to disk
-	for (const auto& [key, value]: directory_labels)
-	{	
-		data = json::value::object();
-		data[to_wstring(key)] = json::value::array();
-		
-		index = 0;
-
-		for (const auto& label: value) data[to_wstring(key)][index++] = json::value(to_wstring(label));
-
-		// create directory with this key name, fails if already exists		
-		filesystem::create_directory(path.string() + "\\" + key);
-
-		// write file to directory
-		ofstream json_file(path.string() + "\\" + key + "\\" + name + ".json");
-		json_file << to_string(data.serialize());
-		json_file.close();
-	}
-}
-
-// assumptions:
-//	argv[1]: valid api key for cloud vision api
-//	argv[2]: file name for input image that exists in images directory
-//	argv[3]: cluster size for kmeans algorithm [2-20]
-// outcomes: 
-//	loads api key from disk
-//	segments input image
-//	labels all images in segments directory
-//	writes labels as json files to disk in output directory
-int main(int argc, char** argv)
-{	
-	int cluster_size;
-	char key_buffer[256], image_buffer[256];
-	string arguments, api_key;
+	// batch runs take a directory or manifest in place of the image name and never rescan images or segments
+	if (options.batch)
+	{
+		const size_t failures = run_batch(filesystem::path(image_buffer), cluster_size, api_key, options, cache.get(), sink,
+			index.get(), manifest.get());
+		if (cache) printf("label cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+		if (manifest) printf("stage manifest: %zu stages skipped\n", manifest->skipped());
+		if (trace_enabled() && trace_export(options.trace)) trace_summary();
 
-	// parse arguments
-	for_each(argv + 1, argv + argc, [&arguments](const char* c_str) { arguments += string(c_str) + " ";	});
-	sscanf_s(arguments.c_str(), "%s %s %d", key_buffer, static_cast<uint>(sizeof(key_buffer)), 
-		image_buffer, static_cast<uint>(sizeof(image_buffer)), &cluster_size);
-	
-	// load api key or fail
-	load_key(string(key_buffer), api_key);
+		return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
 	//assumption that the imgage
 	string image_path = format("./images/%s/%s.jpg", image_buffer, image_buffer);	
+	const string name(image_buffer);
+
+	// with a manifest only this image is labeled, and not at all when its file and settings did not change
+	uint64_t input = 0;
+	const bool hashed = manifest && file_hash(image_path, input);
+	const string segment_parameters = segmentation_parameters(cluster_size, options);
+	const string label_parameters = ::label_parameters(cluster_size, options);
+
+	if (hashed && manifest->complete(name, "labels", input, label_parameters))
+	{
+		printf("up to date:%s\n", name.c_str());
+		return EXIT_SUCCESS;
+	}
 
 	//making the folder for output 
 	auto t = _mkdir(format("./segments/%s", image_buffer).c_str());
 	
 	Mat img = imread(image_path);
-	segmentation(img, string(image_buffer), cluster_size);
-	
-	//cutting the image in five window
-	Rect quadrant1(10, 10, img.cols / 2 - 10, img.rows / 2 - 10);
-	Rect quadrant4(img.cols / 2 + 10, img.rows / 2 + 10, img.cols / 2 - 10, img.rows / 2 - 10);
-	Rect quadrant3(10, img.rows / 2 + 10, img.cols / 2 - 10, img.rows / 2 - 10);
-	Rect quadrant2(img.cols / 2 + 10, 10, img.cols / 2 - 10, img.rows / 2 - 10);
-	
-	//using the window located in the center and have a width of col*0.75, height of row*0.75
-	Rect center(static_cast<int>(img.cols * 0.25 / 2), static_cast<int>(img.rows * 0.25 / 2), 
-		static_cast<int>(img.cols * 0.75), static_cast<int>(img.rows * 0.75));
-	
-	//initializing directory for each cut 
-	string gc_outputfile_dir1 = format("./segments/%s/%s_gc_%s.jpg", image_buffer, image_buffer, "quadrant1");
-	string gc_outputfile_dir2 = format("./segments/%s/%s_gc_%s.jpg", image_buffer, image_buffer, "quadrant2");
-	string gc_outputfile_dir3 = format("./segments/%s/%s_gc_%s.jpg", image_buffer, image_buffer, "quadrant3");
-	string gc_outputfile_dir4 = format("./segments/%s/%s_gc_%s.jpg", image_buffer, image_buffer, "quadrant4");
-	string gc_outputfile_dir5 = format("./segments/%s/%s_gc_%s.jpg", image_buffer, image_buffer, "center");
+	vector<Segment> segments;
+	Mat labels, centers;
+	OutputSink* segment_sink = options.write_segments || !options.in_memory ? &sink : nullptr;
+	vector<string> segment_encodings, segment_owners, segment_names, segment_files;
+
+	// segments written by an earlier run are labeled from disk instead of being computed again
+	const bool segmented = hashed && segment_sink && manifest->complete(name, "segments", input, segment_parameters);
+	if (segmented) img.release();
+
+	// in memory runs encode every segment once for both the sink and the vision payload, otherwise the sink
+	// encodes and writes the segments on its own and they are read back from disk, so no upload is built
+	auto store = [segment_sink, &options](const Segment& segment)
+	{
+		if (options.in_memory) return encode_segment(segment, segment_sink, options);
+
+		write_segment(segment, *segment_sink);
+		return string();
+	};
+
+	// sweeps and tiled runs store every output as soon as it is built, so a sweep only holds one cluster size
+	// and a tiled run reuses its buffer for the next output
+	auto emit = [&](const Segment& segment)
+	{
+		segment_encodings.push_back(store(segment));
+		segment_owners.push_back(segment.directory);
+		segment_names.push_back(segment.name);
+		if (segment_sink) segment_files.push_back(segment_path(segment, segment_sink->extension()));
+	};
+
+	if (segmented) printf("segments up to date:%s\n", name.c_str());
+	else if (options.sweep_first > 0)
+		segmentation_sweep(img, string(image_buffer), options.sweep_first, options.sweep_last, options, emit);
+	else if (options.tile_rows > 0)
+		segmentation_tiled(img, string(image_buffer), cluster_size, options, [&](const Segment& segment)
+		{
+			// a sink encoding its own codec keeps the image, which must not be the reused buffer
+			const bool shared = !options.in_memory || sink_keeps_image(segment_sink, options);
+			emit(shared ? Segment{ segment.directory, segment.name, segment.image.clone() } : segment);
+		});
+	else if (options.grabcut == GrabCutMode::SEEDED)
+		segmentation(img, string(image_buffer), cluster_size, options, segments, &labels, &centers);
+	else segmentation(img, string(image_buffer), cluster_size, options, segments);
+
+	// every segment is stored on the pool, kmeans segments are encoded while grabcut runs
+	ThreadPool encoders;
+	vector<future<string>> encodings;
+	auto encode = [&](size_t first)
+	{
+		for (size_t i = first; i < segments.size(); i++)
+			encodings.push_back(encoders.submit([segment = segments[i], &store]()
+			{
+				return store(segment);
+			}));
+	};
+	encode(0);
 	
-	imwrite(gc_outputfile_dir1, _grabCut(img, quadrant1));
-	imwrite(gc_outputfile_dir2, _grabCut(img, quadrant2));
-	imwrite(gc_outputfile_dir3, _grabCut(img, quadrant3));
-	imwrite(gc_outputfile_dir4, _grabCut(img, quadrant4));
-	imwrite(gc_outputfile_dir5, _grabCut(img, center));
+	//cutting the image into the grabcut windows, by default the four quadrants and the center
+	vector<GrabCutWindow> windows = segmented ? vector<GrabCutWindow>() : window_layout(img.size(), options.windows);
+	vector<Mat> foregrounds = grabcut_windows(img, windows, options, labels, centers);
+	labels.release();
+
+	const size_t grabcut_first = segments.size();
+	for (size_t i = 0; i < windows.size(); i++)
+		segments.push_back({ string(image_buffer), format("%s_gc_%s", image_buffer, windows[i].name.c_str()), foregrounds[i] });
+	encode(grabcut_first);
 
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		segment_encodings.push_back(encodings[i].get());
+		segment_owners.push_back(segments[i].directory);
+		segment_names.push_back(segments[i].name);
+		if (segment_sink) segment_files.push_back(segment_path(segments[i], segment_sink->extension()));
+	}
+	segments.clear();
+	foregrounds.clear();
 	
-	map<string, set<string>> directory_labels;
+	LabelStore directory_labels;
+	size_t failures = 0;
 	
-	label_images(INPUT_PATH, api_key, directory_labels);
-	write_json(OUTPUT_PATH, directory_labels, "base_labels");
+	failures += label_images(manifest ? INPUT_PATH / name : INPUT_PATH, api_key, directory_labels, options, cache.get(), true);
+	save_labels(OUTPUT_PATH, directory_labels, "base_labels", options, &sink, index.get());
 	directory_labels.clear();
 
-	label_images(SEGMENT_PATH, api_key, directory_labels);
-	write_json(OUTPUT_PATH, directory_labels, "segment_labels");
+	// in memory runs label this run's segments straight from the encoded buffers,
+	// otherwise the segments directory is read back from disk once the sink has written it
+	if (options.in_memory && !segmented)
+		failures += label_encodings(segment_encodings, segment_owners, segment_names, api_key, directory_labels, options, cache.get());
+	else
+	{
+		sink.flush();
+		failures += label_images(manifest ? SEGMENT_PATH / name : SEGMENT_PATH, api_key, directory_labels, options, cache.get(), false);
+	}
+	save_labels(OUTPUT_PATH, directory_labels, "segment_labels", options, &sink, index.get());
 	directory_labels.clear();
 
-	return EXIT_SUCCESS;
+	sink.flush();
+	if (sink.failures() > 0) printf("output failures:%zu\n", sink.failures());
+
+	// stages are recorded once their outputs are on disk, labels only when no request was given up on
+	if (hashed && segment_sink && !segmented && sink.failures() == 0)
+		manifest->record(name, "segments", input, segment_parameters, segment_files);
+	if (hashed && failures == 0 && sink.failures() == 0)
+		manifest->record(name, "labels", input, label_parameters, label_files(OUTPUT_PATH, name, options));
+
+	if (cache) printf("label cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+	if (manifest) printf("stage manifest: %zu stages skipped\n", manifest->skipped());
+	if (trace_enabled() && trace_export(options.trace)) trace_summary();
+
+	return failures == 0 && sink.failures() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
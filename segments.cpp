@@ -0,0 +1,261 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+// custom
+#include "base64.h"
+#include "segments.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+// qualities tried in order until an upload fits its byte budget, and the longer side uploads are not halved below
+const int UPLOAD_QUALITIES[] = { 90, 75, 60, 45, 30 };
+const int MIN_UPLOAD_EDGE = 64;
+
+// assumptions:
+//	image: CV_8UC3 image the labels were computed from
+//	labels: CV_32S matrix with one label per pixel of image in row major order
+//	centers: CV_32F matrix with one row of 3 channel values per cluster
+//	segments: properly initialized vector
+// outcome:
+//	segments holds one CV_8UC3 image per cluster where every pixel outside of the cluster is black
+//	full holds image with every pixel replaced by the center of its cluster
+//	the label map is read once, split across row bands
+void extract_segments(const Mat& image, const Mat& labels, const Mat& centers,
+	vector<Mat>& segments, Mat& full)
+{
+	CV_Assert(image.type() == CV_8UC3);
+	CV_Assert(labels.isContinuous() && labels.total() == image.total());
+
+	const int clusters = centers.rows;
+	const size_t row_bytes = static_cast<size_t>(image.cols) * image.elemSize();
+
+	// round centers once instead of converting a float image per cluster
+	Mat palette;
+	centers.reshape(1, clusters).convertTo(palette, CV_8U);
+
+	// buffers are cleared inside the bands so every page is first touched by its writer
+	segments.resize(clusters);
+	for (auto& segment: segments) segment.create(image.size(), CV_8UC3);
+	full.create(image.size(), CV_8UC3);
+
+	parallel_for_(Range(0, image.rows), [&](const Range& band)
+	{
+		const Vec3b* colors = palette.ptr<Vec3b>();
+		vector<Vec3b*> targets(clusters);
+
+		for (int y = band.start; y < band.end; y++)
+		{
+			const Vec3b* pixel = image.ptr<Vec3b>(y);
+			const int* label = labels.ptr<int>() + static_cast<size_t>(y) * image.cols;
+			Vec3b* center = full.ptr<Vec3b>(y);
+
+			for (int center_id = 0; center_id < clusters; center_id++)
+			{
+				targets[center_id] = segments[center_id].ptr<Vec3b>(y);
+				memset(targets[center_id], 0, row_bytes);
+			}
+
+			for (int x = 0; x < image.cols; x++)
+			{
+				targets[label[x]][x] = pixel[x];
+				center[x] = colors[label[x]];
+			}
+		}
+	});
+}
+
+// outcome: returns the path of segment inside the segments directory, extension is appended when given
+string segment_path(const Segment& segment, const string& extension)
+{
+	return format("./segments/%s/%s%s", segment.directory.c_str(), segment.name.c_str(), extension.c_str());
+}
+
+// outcome: returns the bounding box of the pixels of image with any non-zero channel, empty when it is all black
+Rect content_bounds(const Mat& image)
+{
+	const int channels = static_cast<int>(image.elemSize());
+	const int width = image.cols * channels;
+	int top = -1, bottom = -1, left = image.cols, right = -1;
+
+	for (int y = 0; y < image.rows; y++)
+	{
+		const uchar* row = image.ptr(y);
+
+		int first = 0;
+		while (first < width && row[first] == 0) first++;
+		if (first == width) continue;
+
+		int last = width - 1;
+		while (last > first && row[last] == 0) last--;
+
+		if (top < 0) top = y;
+		bottom = y;
+		left = min(left, first / channels);
+		right = max(right, last / channels);
+	}
+
+	if (top < 0) return Rect();
+	return Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+// outcome: whether options change the uploaded images, otherwise they are the default jpeg of the whole image
+bool upload_prepared(const Options& options)
+{
+	return options.upload_crop || options.upload_edge > 0 || options.upload_bytes > 0;
+}
+
+// assumptions:
+//	image: non-empty CV_8UC3 image
+//	options: upload_crop, upload_edge and upload_bytes settings
+// outcome: returns the base64 image sent to the vision api: cropped to content_bounds, scaled down to
+//	upload_edge on its longer side and encoded as the highest quality jpeg or webp that fits upload_bytes,
+//	halving the size while even the lowest quality does not fit, empty string on failure or when it does not
+//	fit upload_bytes at the smallest size either
+string prepare_upload(const Mat& image, const Options& options)
+{
+	TraceScope trace("prepare_upload", image.total() * image.elemSize());
+
+	// an all black segment carries nothing to crop to and is sent whole, it shrinks to almost nothing anyway
+	Mat upload = image;
+	const Rect bounds = options.upload_crop ? content_bounds(image) : Rect();
+	if (!bounds.empty()) upload = image(bounds);
+
+	int edge = max(upload.cols, upload.rows);
+	if (options.upload_edge > 0) edge = min(edge, options.upload_edge);
+
+	// webp is tried next to jpeg when opencv was built with it
+	static const bool webp = haveImageWriter(".webp");
+	vector<uchar> buffer, best;
+
+	while (true)
+	{
+		Mat scaled = upload;
+		const int longer = max(upload.cols, upload.rows);
+		if (edge < longer)
+		{
+			const double scale = static_cast<double>(edge) / longer;
+			resize(upload, scaled, Size(max(static_cast<int>(upload.cols * scale), 1), max(static_cast<int>(upload.rows * scale), 1)),
+				0, 0, INTER_AREA);
+		}
+
+		if (options.upload_bytes == 0)
+		{
+			if (!imencode(".jpg", scaled, best)) best.clear();
+			break;
+		}
+
+		// the smaller of both codecs at every quality, the first one that fits wins
+		for (int quality: UPLOAD_QUALITIES)
+		{
+			if (imencode(".jpg", scaled, buffer, { IMWRITE_JPEG_QUALITY, quality }) && (best.empty() || buffer.size() < best.size()))
+				best.swap(buffer);
+			if (webp && imencode(".webp", scaled, buffer, { IMWRITE_WEBP_QUALITY, quality }) && (best.empty() || buffer.size() < best.size()))
+				best.swap(buffer);
+			if (!best.empty() && best.size() <= options.upload_bytes) break;
+		}
+
+		if (best.empty() || best.size() <= options.upload_bytes || edge <= MIN_UPLOAD_EDGE) break;
+		edge = max(edge / 2, MIN_UPLOAD_EDGE);
+		best.clear();
+	}
+
+	if (best.empty())
+	{
+		printf("conversion failure\n");
+		return string();
+	}
+
+	// an upload over budget would be sent anyway and rejected or billed as a large image
+	if (options.upload_bytes > 0 && best.size() > options.upload_bytes)
+	{
+		printf("upload budget failure:%zu bytes at %d pixels\n", best.size(), edge);
+		return string();
+	}
+	trace.bytes_out(best.size());
+
+	return base64_encode(best.data(), best.size());
+}
+
+// assumptions: image: non-empty CV_8UC3 base image
+// outcome: returns the base64 image sent to the vision api for a whole photo, prepared by prepare_upload when
+//	upload_base is set and the default jpeg of it otherwise, empty string on failure
+string prepare_base_upload(const Mat& image, const Options& options)
+{
+	if (options.upload_base) return prepare_upload(image, options);
+
+	vector<uchar> buffer;
+
+	TraceScope trace("imencode", image.total() * image.elemSize());
+	if (!imencode(".jpg", image, buffer))
+	{
+		printf("conversion failure\n");
+		return string();
+	}
+	trace.bytes_out(buffer.size());
+
+	return base64_encode(buffer.data(), buffer.size());
+}
+
+// assumptions:
+//	segment: non-empty segment image, not modified afterwards while sink may still hold it
+//	sink: writes the segment to segment_path(segment) in the background, nullptr keeps it off disk
+//	options: upload settings, see prepare_upload
+// outcome: returns the base64 upload of segment, empty string on failure, without upload preparation a sink using
+//	default jpeg settings writes the same encoded bytes so the segment is compressed once, otherwise the sink
+//	encodes the full segment itself
+string encode_segment(const Segment& segment, OutputSink* sink, const Options& options)
+{
+	if (upload_prepared(options))
+	{
+		if (sink) sink->write_image(segment_path(segment, ""), segment.image);
+		return prepare_upload(segment.image, options);
+	}
+
+	vector<uchar> buffer;
+
+	TraceScope trace("imencode", segment.image.total() * segment.image.elemSize());
+	if (!imencode(".jpg", segment.image, buffer))
+	{
+		printf("conversion failure\n");
+		return string();
+	}
+	trace.bytes_out(buffer.size());
+
+	string encoding = base64_encode(buffer.data(), buffer.size());
+
+	if (sink && sink->default_jpeg()) sink->write(segment_path(segment), move(buffer));
+	else if (sink) sink->write_image(segment_path(segment, ""), segment.image);
+
+	return encoding;
+}
+
+// assumptions: segment: non-empty segment image, not modified afterwards while sink may still hold it
+// outcome: segment encoded with the sink codec and written to segment_path(segment) in the background,
+//	for runs that read the segments back from disk and never need their upload
+void write_segment(const Segment& segment, OutputSink& sink)
+{
+	sink.write_image(segment_path(segment, ""), segment.image);
+}
+
+// outcome: whether encode_segment hands the segment image itself to sink, so it must not be reused afterwards
+bool sink_keeps_image(const OutputSink* sink, const Options& options)
+{
+	return sink && (!sink->default_jpeg() || upload_prepared(options));
+}
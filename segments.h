@@ -0,0 +1,80 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "options.h"
+#include "output_sink.h"
+
+// segment image produced by segmentation or grabcut, kept in memory until it is encoded
+struct Segment
+{
+	// directory the segment belongs to, the name of the input image
+	std::string directory;
+
+	// file name without extension, ex rose_kmean4_0
+	std::string name;
+
+	cv::Mat image;
+};
+
+// assumptions:
+//	image: CV_8UC3 image the labels were computed from
+//	labels: CV_32S matrix with one label per pixel of image in row major order
+//	centers: CV_32F matrix with one row of 3 channel values per cluster
+//	segments: properly initialized vector
+// outcome:
+//	segments holds one CV_8UC3 image per cluster where every pixel outside of the cluster is black
+//	full holds image with every pixel replaced by the center of its cluster
+//	the label map is read once, split across row bands
+void extract_segments(const cv::Mat& image, const cv::Mat& labels, const cv::Mat& centers,
+	std::vector<cv::Mat>& segments, cv::Mat& full);
+
+// outcome: returns the path of segment inside the segments directory, extension is appended when given
+std::string segment_path(const Segment& segment, const std::string& extension = ".jpg");
+
+// outcome: returns the bounding box of the pixels of image with any non-zero channel, empty when it is all black
+cv::Rect content_bounds(const cv::Mat& image);
+
+// outcome: whether options change the uploaded images, otherwise they are the default jpeg of the whole image
+bool upload_prepared(const Options& options);
+
+// assumptions:
+//	image: non-empty CV_8UC3 image
+//	options: upload_crop, upload_edge and upload_bytes settings
+// outcome: returns the base64 image sent to the vision api: cropped to content_bounds, scaled down to
+//	upload_edge on its longer side and encoded as the highest quality jpeg or webp that fits upload_bytes,
+//	halving the size while even the lowest quality does not fit, empty string on failure or when it does not
+//	fit upload_bytes at the smallest size either
+std::string prepare_upload(const cv::Mat& image, const Options& options);
+
+// assumptions: image: non-empty CV_8UC3 base image
+// outcome: returns the base64 image sent to the vision api for a whole photo, prepared by prepare_upload when
+//	upload_base is set and the default jpeg of it otherwise, empty string on failure
+std::string prepare_base_upload(const cv::Mat& image, const Options& options);
+
+// assumptions:
+//	segment: non-empty segment image, not modified afterwards while sink may still hold it
+//	sink: writes the segment to segment_path(segment) in the background, nullptr keeps it off disk
+//	options: upload settings, see prepare_upload
+// outcome: returns the base64 upload of segment, empty string on failure, without upload preparation a sink using
+//	default jpeg settings writes the same encoded bytes so the segment is compressed once, otherwise the sink
+//	encodes the full segment itself
+std::string encode_segment(const Segment& segment, OutputSink* sink, const Options& options);
+
+// assumptions: segment: non-empty segment image, not modified afterwards while sink may still hold it
+// outcome: segment encoded with the sink codec and written to segment_path(segment) in the background,
+//	for runs that read the segments back from disk and never need their upload
+void write_segment(const Segment& segment, OutputSink& sink);
+
+// outcome: whether encode_segment hands the segment image itself to sink, so it must not be reused afterwards
+bool sink_keeps_image(const OutputSink* sink, const Options& options);
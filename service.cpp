@@ -0,0 +1,211 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// vcpkg
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+// custom
+#include "base64.h"
+#include "batch.h"
+#include "label_cache.h"
+#include "label_store.h"
+#include "manifest.h"
+#include "pipeline.h"
+#include "service.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+using namespace web;
+
+// global constants
+const wstring JOBS_PATH = L"/jobs";
+
+// assumptions:
+//	uri: http address to listen on, ex http://localhost:8090/
+//	api_key: valid gcp vision api key
+//	cluster_size: cluster size of jobs that do not name one
+//	options: pipeline settings every job starts from, batch_threads sizes the pool
+//	cache: label cache or nullptr, must outlive the service
+//	sink: writes the segments, must outlive the service
+// outcome: opencv is initialized and the service is listening on uri
+SegmentationService::SegmentationService(const wstring& uri, const string& api_key, int cluster_size, const Options& options,
+	LabelCache* cache, OutputSink& sink)
+	: api_key(api_key), cluster_size(cluster_size), options(options), cache(cache), sink(sink), pool(options.batch_threads),
+	listener(web::uri(uri))
+{
+	// the first encode loads the codecs and starts the opencv thread pool, so the first job does not pay for it
+	vector<uchar> buffer;
+	imencode(".jpg", Mat(8, 8, CV_8UC3, Scalar::all(0)), buffer);
+
+	listener.support([this](http::http_request request) { handle(request); });
+	listener.open().wait();
+}
+
+// outcome: service stopped listening, jobs in progress are finished
+SegmentationService::~SegmentationService()
+{
+	try { listener.close().wait(); }
+	catch (const exception& e) { printf("service close exception:%s\n", e.what()); }
+}
+
+// outcome: number of jobs answered with labels so far
+size_t SegmentationService::served() const
+{
+	return served_count.load();
+}
+
+// outcome: number of jobs rejected or failed so far
+size_t SegmentationService::failures() const
+{
+	return failure_count.load();
+}
+
+// assumptions: request: POST of a job to the jobs path, GET of the jobs path returns the job counts
+// outcome: the job runs on the pool and is answered from there, so the listener threads never block on it,
+//	an invalid job is answered with 400 and its reason
+void SegmentationService::handle(http::http_request request)
+{
+	if (request.relative_uri().path() != JOBS_PATH)
+	{
+		request.reply(http::status_codes::NotFound);
+		return;
+	}
+
+	if (request.method() == http::methods::GET)
+	{
+		json::value counts = json::value::object();
+		counts[L"served"] = json::value(static_cast<int>(served()));
+		counts[L"failures"] = json::value(static_cast<int>(failures()));
+		request.reply(http::status_codes::OK, counts);
+		return;
+	}
+
+	if (request.method() != http::methods::POST)
+	{
+		request.reply(http::status_codes::MethodNotAllowed);
+		return;
+	}
+
+	request.extract_json().then([this, request](pplx::task<json::value> previous)
+	{
+		try
+		{
+			json::value job = previous.get();
+			pool.submit([this, request, job]()
+			{
+				try
+				{
+					json::value reply = run(job);
+					served_count++;
+					request.reply(http::status_codes::OK, reply);
+				}
+				catch (const exception& e)
+				{
+					failure_count++;
+					printf("job failure:%s\n", e.what());
+					request.reply(http::status_codes::BadRequest, json::value::string(to_wstring(e.what())));
+				}
+			});
+		}
+		catch (const exception& e)
+		{
+			failure_count++;
+			request.reply(http::status_codes::BadRequest, json::value::string(to_wstring(e.what())));
+		}
+	});
+}
+
+// assumptions: job: json object described in service.h
+// outcome: the image is segmented, its segments are written by the sink and the image and every segment are
+//	labeled in one round of requests, returns the reply, throws on an invalid job or unreadable image
+json::value SegmentationService::run(const json::value& job)
+{
+	vector<uchar> bytes;
+	string name;
+
+	if (job.has_field(L"content"))
+	{
+		const string content = to_string(job.at(L"content").as_string());
+		if (!base64_decode(content.data(), content.size(), bytes)) throw invalid_argument("content is not base64");
+
+		// named by content, so a restarted service never reuses the name of different earlier content
+		name = format("job%016llx", static_cast<unsigned long long>(hash64(bytes.data(), bytes.size())));
+	}
+	else if (job.has_field(L"path"))
+	{
+		const filesystem::path path(to_string(job.at(L"path").as_string()));
+		uint64_t hash;
+		if (!file_hash(path.string(), hash, &bytes)) throw invalid_argument("read failure:" + path.string());
+		name = path.stem().string();
+	}
+	else throw invalid_argument("path or content required");
+
+	// the name becomes a directory, so it may not leave the segments directory
+	if (job.has_field(L"name")) name = to_string(job.at(L"name").as_string());
+	if (name.empty() || name == "." || name == ".." || name.find_first_of("/\\:") != string::npos)
+		throw invalid_argument("invalid name:" + name);
+
+	Options job_options = options;
+	if (job.has_field(L"windows")) job_options.windows = to_string(job.at(L"windows").as_string());
+
+	const int clusters = job.has_field(L"cluster_size") ? job.at(L"cluster_size").as_integer() : cluster_size;
+	if (clusters < 1) throw invalid_argument(format("invalid cluster size:%d", clusters));
+
+	OutputSink* segment_sink = options.write_segments ? &sink : nullptr;
+	ImageWork work = process_image(bytes, name, clusters, job_options, segment_sink);
+	bytes.clear();
+
+	// the image and its segments share the requests, each one keeps its own labels
+	vector<string> encodings = { move(work.base) }, owners = { name };
+	encodings.insert(encodings.end(), make_move_iterator(work.segments.begin()), make_move_iterator(work.segments.end()));
+	owners.insert(owners.end(), work.names.begin(), work.names.end());
+	work.segments.clear();
+
+	// every owner is its own directory, so the directory statistics are the labels of that image
+	vector<string> names = owners;
+	LabelStore store;
+	const size_t failures = label_encodings(encodings, owners, names, api_key, store, job_options, cache);
+	const auto labels = store.snapshot();
+
+	auto labels_of = [&labels](const string& owner)
+	{
+		auto found = labels.find(owner);
+		return label_json(found == labels.end() ? vector<pair<string, LabelStats>>() : found->second);
+	};
+
+	json::value reply = json::value::object();
+	reply[L"name"] = json::value(to_wstring(name));
+	reply[L"labels"] = labels_of(name);
+	reply[L"segments"] = json::value::array();
+	reply[L"failures"] = json::value(static_cast<int>(failures));
+
+	for (size_t i = 0; i < work.names.size(); i++)
+	{
+		json::value segment = json::value::object();
+		segment[L"name"] = json::value(to_wstring(work.names[i]));
+		segment[L"path"] = json::value(to_wstring(i < work.outputs.size() ? work.outputs[i] : string()));
+		segment[L"labels"] = labels_of(work.names[i]);
+		reply[L"segments"][i] = segment;
+	}
+
+	// the reply only references segments that are on disk, other jobs' files are not waited for
+	if (segment_sink) segment_sink->flush(work.outputs);
+
+	return reply;
+}
@@ -0,0 +1,71 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <atomic>
+#include <string>
+
+// vcpkg
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+// custom
+#include "label_cache.h"
+#include "options.h"
+#include "output_sink.h"
+#include "thread_pool.h"
+
+// long running segmentation and labeling service
+//	jobs are posted as json to <uri>jobs and answered with the labels of the image and of every segment,
+//	the api key, label cache, output sink, worker pool and annotate connections stay warm between jobs
+//	so a job only pays for its own compute and requests, concurrent jobs run side by side on the pool
+//	job: { "path": image file | "content": base64 image, "name": segment directory, defaults to the file name
+//		or job<content hash>,
+//		"cluster_size": integer, defaults to the command line one, "windows": grabcut window layout }
+//	reply: { "name", "labels": [label], "segments": [{ "name", "path", "labels": [label] }], "failures" },
+//		label as written by write_json, path empty when segments are not written
+class SegmentationService
+{
+public:
+	// assumptions:
+	//	uri: http address to listen on, ex http://localhost:8090/
+	//	api_key: valid gcp vision api key
+	//	cluster_size: cluster size of jobs that do not name one
+	//	options: pipeline settings every job starts from, batch_threads sizes the pool
+	//	cache: label cache or nullptr, must outlive the service
+	//	sink: writes the segments, must outlive the service
+	// outcome: opencv is initialized and the service is listening on uri
+	SegmentationService(const std::wstring& uri, const std::string& api_key, int cluster_size, const Options& options,
+		LabelCache* cache, OutputSink& sink);
+
+	// outcome: service stopped listening, jobs in progress are finished
+	~SegmentationService();
+
+	SegmentationService(const SegmentationService&) = delete;
+	SegmentationService& operator=(const SegmentationService&) = delete;
+
+	// outcome: number of jobs answered with labels so far
+	size_t served() const;
+
+	// outcome: number of jobs rejected or failed so far
+	size_t failures() const;
+
+private:
+	void handle(web::http::http_request request);
+	web::json::value run(const web::json::value& job);
+
+	std::string api_key;
+	int cluster_size;
+	Options options;
+	LabelCache* cache;
+	OutputSink& sink;
+	std::atomic<size_t> served_count{ 0 };
+	std::atomic<size_t> failure_count{ 0 };
+
+	// declared last so the listener closes first and the pool drains before anything it uses is destroyed
+	ThreadPool pool;
+	web::http::experimental::listener::http_listener listener;
+};
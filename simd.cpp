@@ -0,0 +1,66 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// simd
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// custom
+#include "simd.h"
+
+#if defined(SIMD_X86)
+// outcome: returns the widest instruction set the cpu and os support
+static int detect_simd()
+{
+	unsigned int registers[4] = { 0, 0, 0, 0 };
+	bool ssse3 = false, avx2 = false;
+
+#if defined(_MSC_VER)
+	__cpuid(reinterpret_cast<int*>(registers), 1);
+#else
+	__get_cpuid(1, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+	ssse3 = (registers[2] & (1u << 9)) != 0;
+
+	// avx2 also needs the os to save the ymm registers
+	const bool osxsave = (registers[2] & (1u << 27)) != 0 && (registers[2] & (1u << 28)) != 0;
+
+#if defined(_MSC_VER)
+	__cpuidex(reinterpret_cast<int*>(registers), 7, 0);
+#else
+	__get_cpuid_count(7, 0, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+	if (osxsave)
+	{
+#if defined(_MSC_VER)
+		const unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int eax, edx;
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		const unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+		avx2 = (registers[1] & (1u << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+	}
+
+	return avx2 ? SIMD_AVX2 : ssse3 ? SIMD_SSSE3 : SIMD_NONE;
+}
+#endif
+
+// outcome: returns the widest instruction set the cpu and os support, detected on first use,
+//	SIMD_NONE on other architectures
+int simd_level()
+{
+#if defined(SIMD_X86)
+	static const int level = detect_simd();
+	return level;
+#else
+	return SIMD_NONE;
+#endif
+}
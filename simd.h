@@ -0,0 +1,14 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// instruction set levels of the x86 code paths, picked at runtime so one build runs on every x64 cpu
+const int SIMD_NONE = 0;
+const int SIMD_SSSE3 = 1;
+const int SIMD_AVX2 = 2;
+
+// outcome: returns the widest instruction set the cpu and os support, detected on first use,
+//	SIMD_NONE on other architectures
+int simd_level();
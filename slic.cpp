@@ -0,0 +1,408 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <set>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// custom
+#include "slic.h"
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+// sums kept per superpixel and band: pixels, l, a, b, x and y
+const int SLIC_MOMENTS = 6;
+
+// superpixels below a quarter of the grid cell are absorbed by a neighbor when connectivity is enforced
+const int MIN_SUPERPIXEL_FRACTION = 4;
+
+// seed of a superpixel in lab color and pixel coordinates
+struct SlicCenter
+{
+	double color[3];
+	double x;
+	double y;
+};
+
+// adjacent pair of regions and the squared color error their merge adds, versions tell stale entries apart
+struct RegionMerge
+{
+	double cost;
+	int a;
+	int b;
+	int version_a;
+	int version_b;
+
+	bool operator>(const RegionMerge& other) const { return cost > other.cost; }
+};
+
+// outcome: returns the squared lab gradient of lab at x, y, which must not lie on the border
+static double gradient(const Mat& lab, int x, int y)
+{
+	const Vec3b& left = lab.at<Vec3b>(y, x - 1), & right = lab.at<Vec3b>(y, x + 1);
+	const Vec3b& up = lab.at<Vec3b>(y - 1, x), & down = lab.at<Vec3b>(y + 1, x);
+
+	double sum = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		const double dx = right[c] - left[c], dy = down[c] - up[c];
+		sum += dx * dx + dy * dy;
+	}
+	return sum;
+}
+
+// assumptions: labels: CV_32S superpixel of every pixel, step: grid cell side
+// outcome: every connected piece of a superpixel gets its own label, pieces smaller than a fraction of a grid cell
+//	join the superpixel before them in scan order, returns the number of labels
+static int enforce_connectivity(Mat& labels, int step)
+{
+	const int rows = labels.rows, cols = labels.cols;
+	const size_t min_size = max<size_t>(static_cast<size_t>(step) * step / MIN_SUPERPIXEL_FRACTION, 1);
+	const int dx[] = { -1, 1, 0, 0 }, dy[] = { 0, 0, -1, 1 };
+
+	Mat connected(labels.size(), CV_32S, Scalar(-1));
+	vector<int> piece;
+	int count = 0;
+
+	for (int y = 0; y < rows; y++)
+		for (int x = 0; x < cols; x++)
+		{
+			if (connected.at<int>(y, x) >= 0) continue;
+
+			// a neighbor labeled before this piece takes it over when it is too small
+			int adjacent = -1;
+			if (x > 0) adjacent = connected.at<int>(y, x - 1);
+			else if (y > 0) adjacent = connected.at<int>(y - 1, x);
+
+			const int old_label = labels.at<int>(y, x);
+			piece.assign(1, y * cols + x);
+			connected.at<int>(y, x) = count;
+
+			for (size_t i = 0; i < piece.size(); i++)
+			{
+				const int px = piece[i] % cols, py = piece[i] / cols;
+
+				for (int d = 0; d < 4; d++)
+				{
+					const int nx = px + dx[d], ny = py + dy[d];
+					if (nx < 0 || nx >= cols || ny < 0 || ny >= rows) continue;
+					if (connected.at<int>(ny, nx) >= 0 || labels.at<int>(ny, nx) != old_label) continue;
+
+					connected.at<int>(ny, nx) = count;
+					piece.push_back(ny * cols + nx);
+				}
+			}
+
+			if (piece.size() < min_size && adjacent >= 0)
+				for (int index: piece) connected.at<int>(index / cols, index % cols) = adjacent;
+			else count++;
+		}
+
+	labels = connected;
+	return count;
+}
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	superpixels: number of superpixels aimed for, at least 1
+//	compactness: weight of the spatial distance against the color distance in 8 bit lab units, higher is more regular
+//	iterations: assignment and update passes
+// outcome: labels holds the CV_32S rows x cols superpixel of every pixel and their count is returned,
+//	every superpixel is spatially connected, each pass is split across row bands
+int slic_superpixels(const Mat& image, int superpixels, double compactness, int iterations, Mat& labels)
+{
+	CV_Assert(image.type() == CV_8UC3 && superpixels >= 1);
+	TraceScope trace("slic_superpixels", image.total() * image.elemSize());
+
+	// 8 bit lab keeps the working copy the size of the image, no float copy of the pixels is made
+	Mat lab;
+	cvtColor(image, lab, COLOR_BGR2Lab);
+
+	const int step = max(cvRound(sqrt(static_cast<double>(image.total()) / superpixels)), 1);
+	const int grid_cols = (image.cols + step - 1) / step, grid_rows = (image.rows + step - 1) / step;
+	const int count = grid_cols * grid_rows;
+	const double spatial_weight = compactness * compactness / (static_cast<double>(step) * step);
+
+	// every center starts in the middle of its grid cell, moved to the lowest gradient of its 3 x 3 neighborhood
+	// so it does not sit on an edge
+	vector<SlicCenter> centers(count);
+	for (int gy = 0; gy < grid_rows; gy++)
+		for (int gx = 0; gx < grid_cols; gx++)
+		{
+			int cx = min(gx * step + step / 2, image.cols - 1), cy = min(gy * step + step / 2, image.rows - 1);
+
+			if (image.cols > 2 && image.rows > 2)
+			{
+				int best_x = cx, best_y = cy;
+				double best = -1;
+
+				for (int y = max(cy - 1, 1); y <= min(cy + 1, image.rows - 2); y++)
+					for (int x = max(cx - 1, 1); x <= min(cx + 1, image.cols - 2); x++)
+					{
+						const double value = gradient(lab, x, y);
+						if (best >= 0 && value >= best) continue;
+
+						best = value;
+						best_x = x;
+						best_y = y;
+					}
+				cx = best_x;
+				cy = best_y;
+			}
+
+			const Vec3b& color = lab.at<Vec3b>(cy, cx);
+			centers[gy * grid_cols + gx] = { { static_cast<double>(color[0]), static_cast<double>(color[1]),
+				static_cast<double>(color[2]) }, static_cast<double>(cx), static_cast<double>(cy) };
+		}
+
+	labels.create(image.size(), CV_32S);
+	const int stripes = max(getNumThreads(), 1);
+	vector<vector<double>> partials(stripes);
+
+	for (int iteration = 0; iteration < max(iterations, 1); iteration++)
+	{
+		// every pixel picks the closest of the centers seeded in its own and the 8 surrounding grid cells,
+		// which covers the 2 step search window of every center without two bands writing the same label
+		parallel_for_(Range(0, stripes), [&](const Range& range)
+		{
+			for (int stripe = range.start; stripe < range.end; stripe++)
+			{
+				vector<double>& moments = partials[stripe];
+				moments.assign(static_cast<size_t>(count) * SLIC_MOMENTS, 0);
+
+				for (int y = image.rows * stripe / stripes; y < image.rows * (stripe + 1) / stripes; y++)
+				{
+					const Vec3b* pixel = lab.ptr<Vec3b>(y);
+					int* label = labels.ptr<int>(y);
+					const int gy = min(y / step, grid_rows - 1);
+
+					for (int x = 0; x < image.cols; x++)
+					{
+						const int gx = min(x / step, grid_cols - 1);
+						double best = -1;
+						int closest = 0;
+
+						for (int ny = max(gy - 1, 0); ny <= min(gy + 1, grid_rows - 1); ny++)
+							for (int nx = max(gx - 1, 0); nx <= min(gx + 1, grid_cols - 1); nx++)
+							{
+								const int k = ny * grid_cols + nx;
+								const SlicCenter& center = centers[k];
+								const double d0 = pixel[x][0] - center.color[0], d1 = pixel[x][1] - center.color[1],
+									d2 = pixel[x][2] - center.color[2], sx = x - center.x, sy = y - center.y;
+								const double distance = d0 * d0 + d1 * d1 + d2 * d2 + (sx * sx + sy * sy) * spatial_weight;
+
+								if (best < 0 || distance < best)
+								{
+									best = distance;
+									closest = k;
+								}
+							}
+
+						label[x] = closest;
+						double* moment = moments.data() + static_cast<size_t>(closest) * SLIC_MOMENTS;
+						moment[0] += 1;
+						moment[1] += pixel[x][0];
+						moment[2] += pixel[x][1];
+						moment[3] += pixel[x][2];
+						moment[4] += x;
+						moment[5] += y;
+					}
+				}
+			}
+		});
+
+		// centers move to the mean of their pixels, a center that lost every pixel stays where it was
+		for (int k = 0; k < count; k++)
+		{
+			double moment[SLIC_MOMENTS] = {};
+			for (const auto& partial: partials)
+				for (int m = 0; m < SLIC_MOMENTS; m++) moment[m] += partial[static_cast<size_t>(k) * SLIC_MOMENTS + m];
+
+			if (moment[0] == 0) continue;
+			centers[k] = { { moment[1] / moment[0], moment[2] / moment[0], moment[3] / moment[0] },
+				moment[4] / moment[0], moment[5] / moment[0] };
+		}
+	}
+
+	const int connected = enforce_connectivity(labels, step);
+	trace.bytes_out(labels.total() * labels.elemSize());
+
+	return connected;
+}
+
+// assumptions:
+//	image: CV_8UC3 image the superpixels were computed from
+//	superpixels: labels and count returned by slic_superpixels
+//	sizes: region counts wanted, any order, each at least 1
+// outcome: labels[i] and centers[i] hold the CV_32S N x 1 region of every pixel and the CV_32F sizes[i] x 3 mean
+//	colors of the regions, like cv::kmeans, after merging the superpixels down to sizes[i] regions
+//	adjacent regions are merged greedily in order of the least increase of squared color error, one merge
+//	sequence serves every size, sizes above the superpixel count leave their extra regions empty
+void merge_superpixels(const Mat& image, const Mat& superpixels, int count, const vector<int>& sizes,
+	vector<Mat>& labels, vector<Mat>& centers)
+{
+	labels.assign(sizes.size(), Mat());
+	centers.assign(sizes.size(), Mat());
+
+	merge_superpixels(image, superpixels, count, sizes, [&](size_t i, const Mat& size_labels, const Mat& size_centers)
+	{
+		labels[i] = size_labels;
+		centers[i] = size_centers;
+	});
+}
+
+// assumptions: as in merge_superpixels above
+// outcome: emit called with the index in sizes, the labels and the centers of every size as soon as it is reached,
+//	largest size first, so only one labeling is held at a time
+void merge_superpixels(const Mat& image, const Mat& superpixels, int count, const vector<int>& sizes,
+	const function<void(size_t, const Mat&, const Mat&)>& emit)
+{
+	CV_Assert(image.type() == CV_8UC3 && superpixels.type() == CV_32S && superpixels.size() == image.size());
+	TraceScope trace("merge_superpixels", superpixels.total() * superpixels.elemSize());
+
+	// color sums, sizes and neighbors of every superpixel in one scan
+	vector<double> pixels(count, 0);
+	vector<Vec3d> sums(count, Vec3d(0, 0, 0));
+	vector<set<int>> neighbors(count);
+
+	for (int y = 0; y < image.rows; y++)
+	{
+		const Vec3b* pixel = image.ptr<Vec3b>(y);
+		const int* label = superpixels.ptr<int>(y);
+		const int* below = y + 1 < image.rows ? superpixels.ptr<int>(y + 1) : nullptr;
+
+		for (int x = 0; x < image.cols; x++)
+		{
+			const int k = label[x];
+			pixels[k] += 1;
+			for (int c = 0; c < 3; c++) sums[k][c] += pixel[x][c];
+
+			if (x + 1 < image.cols && label[x + 1] != k)
+			{
+				neighbors[k].insert(label[x + 1]);
+				neighbors[label[x + 1]].insert(k);
+			}
+			if (below && below[x] != k)
+			{
+				neighbors[k].insert(below[x]);
+				neighbors[below[x]].insert(k);
+			}
+		}
+	}
+
+	auto cost = [&](int a, int b)
+	{
+		const Vec3d difference = sums[a] * (1.0 / pixels[a]) - sums[b] * (1.0 / pixels[b]);
+		return pixels[a] * pixels[b] / (pixels[a] + pixels[b]) * difference.dot(difference);
+	};
+
+	vector<int> parent(count), version(count, 0);
+	for (int k = 0; k < count; k++) parent[k] = k;
+
+	function<int(int)> find = [&](int k) { return parent[k] == k ? k : parent[k] = find(parent[k]); };
+
+	priority_queue<RegionMerge, vector<RegionMerge>, greater<RegionMerge>> merges;
+	for (int a = 0; a < count; a++)
+		for (int b: neighbors[a])
+			if (a < b) merges.push({ cost(a, b), a, b, 0, 0 });
+
+	// the largest sizes are reached first, so every snapshot is taken on the way down
+	vector<size_t> order(sizes.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+	int regions = count;
+
+	for (size_t i: order)
+	{
+		const int size = sizes[i];
+
+		// the adjacency graph of the connected superpixels is connected, so merges only run out at one region
+		while (regions > size && !merges.empty())
+		{
+			const RegionMerge merge = merges.top();
+			merges.pop();
+			if (parent[merge.a] != merge.a || parent[merge.b] != merge.b) continue;
+			if (version[merge.a] != merge.version_a || version[merge.b] != merge.version_b) continue;
+
+			// the smaller region joins the larger one and takes its neighbors along
+			const int keep = pixels[merge.a] >= pixels[merge.b] ? merge.a : merge.b;
+			const int gone = keep == merge.a ? merge.b : merge.a;
+
+			parent[gone] = keep;
+			pixels[keep] += pixels[gone];
+			sums[keep] += sums[gone];
+			version[keep]++;
+
+			for (int neighbor: neighbors[gone])
+			{
+				neighbors[neighbor].erase(gone);
+				if (neighbor == keep) continue;
+				neighbors[neighbor].insert(keep);
+				neighbors[keep].insert(neighbor);
+			}
+			neighbors[keep].erase(gone);
+			neighbors[gone].clear();
+
+			for (int neighbor: neighbors[keep])
+				merges.push({ cost(keep, neighbor), keep, neighbor, version[keep], version[neighbor] });
+			regions--;
+		}
+
+		// regions are numbered in superpixel order, regions beyond the ones left stay empty
+		vector<int> region(count, -1);
+		Mat colors(max(size, regions), 3, CV_32F, Scalar(0));
+		int next = 0;
+
+		for (int k = 0; k < count; k++)
+		{
+			const int root = find(k);
+			if (region[root] < 0)
+			{
+				region[root] = next++;
+				for (int c = 0; c < 3; c++) colors.at<float>(region[root], c) = static_cast<float>(sums[root][c] / pixels[root]);
+			}
+			region[k] = region[root];
+		}
+
+		Mat pixel_labels(static_cast<int>(superpixels.total()), 1, CV_32S);
+		parallel_for_(Range(0, image.rows), [&](const Range& band)
+		{
+			for (int y = band.start; y < band.end; y++)
+			{
+				const int* label = superpixels.ptr<int>(y);
+				int* target = pixel_labels.ptr<int>() + static_cast<size_t>(y) * image.cols;
+				for (int x = 0; x < image.cols; x++) target[x] = region[label[x]];
+			}
+		});
+
+		emit(i, pixel_labels, colors);
+	}
+}
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	sizes: segment counts wanted, each at least 1
+//	options: slic_superpixels, slic_compactness and slic_iterations settings
+// outcome: labels[i] and centers[i] hold the spatially coherent segmentation of image into sizes[i] regions,
+//	in the layout of cv::kmeans, the superpixels are computed once for every size
+void slic_clusters(const Mat& image, const vector<int>& sizes, const Options& options, vector<Mat>& labels, vector<Mat>& centers)
+{
+	Mat superpixels;
+	const int count = slic_superpixels(image, max(options.slic_superpixels, 1), options.slic_compactness,
+		options.slic_iterations, superpixels);
+	merge_superpixels(image, superpixels, count, sizes, labels, centers);
+}
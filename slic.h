@@ -0,0 +1,50 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <functional>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "options.h"
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	superpixels: number of superpixels aimed for, at least 1
+//	compactness: weight of the spatial distance against the color distance in 8 bit lab units, higher is more regular
+//	iterations: assignment and update passes
+// outcome: labels holds the CV_32S rows x cols superpixel of every pixel and their count is returned,
+//	every superpixel is spatially connected, each pass is split across row bands
+int slic_superpixels(const cv::Mat& image, int superpixels, double compactness, int iterations, cv::Mat& labels);
+
+// assumptions:
+//	image: CV_8UC3 image the superpixels were computed from
+//	superpixels: labels and count returned by slic_superpixels
+//	sizes: region counts wanted, any order, each at least 1
+// outcome: labels[i] and centers[i] hold the CV_32S N x 1 region of every pixel and the CV_32F sizes[i] x 3 mean
+//	colors of the regions, like cv::kmeans, after merging the superpixels down to sizes[i] regions
+//	adjacent regions are merged greedily in order of the least increase of squared color error, one merge
+//	sequence serves every size, sizes above the superpixel count leave their extra regions empty
+void merge_superpixels(const cv::Mat& image, const cv::Mat& superpixels, int count, const std::vector<int>& sizes,
+	std::vector<cv::Mat>& labels, std::vector<cv::Mat>& centers);
+
+// assumptions: as in merge_superpixels above
+// outcome: emit called with the index in sizes, the labels and the centers of every size as soon as it is reached,
+//	largest size first, so only one labeling is held at a time
+void merge_superpixels(const cv::Mat& image, const cv::Mat& superpixels, int count, const std::vector<int>& sizes,
+	const std::function<void(size_t, const cv::Mat&, const cv::Mat&)>& emit);
+
+// assumptions:
+//	image: continuous CV_8UC3 image
+//	sizes: segment counts wanted, each at least 1
+//	options: slic_superpixels, slic_compactness and slic_iterations settings
+// outcome: labels[i] and centers[i] hold the spatially coherent segmentation of image into sizes[i] regions,
+//	in the layout of cv::kmeans, the superpixels are computed once for every size
+void slic_clusters(const cv::Mat& image, const std::vector<int>& sizes, const Options& options,
+	std::vector<cv::Mat>& labels, std::vector<cv::Mat>& centers);
@@ -0,0 +1,114 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// custom
+#include "thread_pool.h"
+
+// namespaces
+using namespace std;
+
+// pool and queue of the worker running on this thread, nullptr outside of any pool
+static thread_local const void* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+// assumptions: threads: number of workers, 0 uses one per hardware thread
+ThreadPool::ThreadPool(size_t threads)
+{
+	if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+
+	for (size_t i = 0; i < threads; i++) queues.push_back(make_unique<Queue>());
+	for (size_t i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+// outcome: waits for queued tasks to finish and joins the workers
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+
+	for (auto& worker: workers) worker.join();
+}
+
+// outcome: number of worker threads
+size_t ThreadPool::size() const
+{
+	return workers.size();
+}
+
+// outcome: task queued on the calling worker or the next queue in turn, one sleeping worker woken
+void ThreadPool::push(function<void()> task)
+{
+	const size_t worker = current_pool == this ? current_worker : next++ % queues.size();
+
+	{
+		lock_guard<std::mutex> lock(queues[worker]->mutex);
+		queues[worker]->tasks.push_back(move(task));
+	}
+
+	{
+		lock_guard<std::mutex> lock(mutex);
+		pending++;
+	}
+	ready.notify_one();
+}
+
+// outcome: returns true and the newest task of the own queue, or else the oldest task of another queue
+bool ThreadPool::pop(size_t worker, function<void()>& task)
+{
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		Queue& queue = *queues[(worker + i) % queues.size()];
+		lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.tasks.empty()) continue;
+
+		if (i == 0)
+		{
+			task = move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		pending--;
+
+		return true;
+	}
+
+	return false;
+}
+
+// outcome: runs queued tasks until the pool is stopping and every queue is empty
+void ThreadPool::work(size_t worker)
+{
+	current_pool = this;
+	current_worker = worker;
+
+	for (;;)
+	{
+		function<void()> task;
+
+		if (pop(worker, task))
+		{
+			task();
+			continue;
+		}
+
+		unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this]() { return stopping || pending > 0; });
+
+		if (stopping && pending == 0) return;
+	}
+}
@@ -0,0 +1,69 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// fixed number of worker threads with one task queue each
+//	tasks submitted from a worker go to its own queue and run newest first, keeping their data warm,
+//	other tasks are spread round robin, idle workers steal the oldest task of a busy worker
+class ThreadPool
+{
+public:
+	// assumptions: threads: number of workers, 0 uses one per hardware thread
+	explicit ThreadPool(size_t threads = 0);
+
+	// outcome: waits for queued tasks to finish and joins the workers
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// outcome: task is queued, the future holds its result or exception
+	template <typename Task>
+	std::future<std::invoke_result_t<Task>> submit(Task task)
+	{
+		auto packaged = std::make_shared<std::packaged_task<std::invoke_result_t<Task>()>>(std::move(task));
+		std::future<std::invoke_result_t<Task>> result = packaged->get_future();
+
+		push([packaged]() { (*packaged)(); });
+
+		return result;
+	}
+
+	// outcome: number of worker threads
+	size_t size() const;
+
+private:
+	struct Queue
+	{
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+	};
+
+	void push(std::function<void()> task);
+	bool pop(size_t worker, std::function<void()>& task);
+	void work(size_t worker);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next{ 0 };
+
+	// queued tasks across all queues, only raised under mutex so a sleeping worker never misses one
+	std::atomic<size_t> pending{ 0 };
+	std::mutex mutex;
+	std::condition_variable ready;
+	bool stopping = false;
+};
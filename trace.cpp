@@ -0,0 +1,294 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core.hpp>
+
+// custom
+#include "trace.h"
+
+// namespaces
+using namespace cv;
+using namespace std;
+
+// global constants
+// spans kept per thread for the export, older ones are overwritten so a long running process stays bounded,
+// the summary counts every span
+const size_t TRACE_CAPACITY = 1 << 16;
+
+// one finished span
+struct TraceEvent
+{
+	const char* name;
+	int64_t start;
+	int64_t duration;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	int64_t peak;
+};
+
+// totals of every span of one name
+struct TraceSummary
+{
+	size_t count = 0;
+	int64_t total = 0;
+	int64_t longest = 0;
+	uint64_t bytes_in = 0;
+	uint64_t bytes_out = 0;
+	int64_t peak = 0;
+
+	void add(const TraceSummary& other)
+	{
+		count += other.count;
+		total += other.total;
+		longest = max(longest, other.longest);
+		bytes_in += other.bytes_in;
+		bytes_out += other.bytes_out;
+		peak = max(peak, other.peak);
+	}
+};
+
+// spans and mat allocation counters of one thread, owned by the registry so they outlive the thread
+struct ThreadTrace
+{
+	uint32_t id;
+	mutex events_mutex;
+
+	// ring of the latest spans, written counts every span ever stored, summaries are keyed by name literal
+	vector<TraceEvent> events;
+	uint64_t written = 0;
+	map<const char*, TraceSummary> summaries;
+
+	// only touched by the owning thread
+	int64_t allocated = 0;
+	int64_t peak = 0;
+};
+
+static atomic<bool> tracing{ false };
+static chrono::steady_clock::time_point trace_epoch;
+
+static mutex registry_mutex;
+static vector<unique_ptr<ThreadTrace>> registry;
+
+// outcome: returns the trace buffer of the calling thread, registered on first use
+static ThreadTrace& local_trace()
+{
+	thread_local ThreadTrace* local = nullptr;
+
+	if (!local)
+	{
+		lock_guard<mutex> lock(registry_mutex);
+		registry.push_back(make_unique<ThreadTrace>());
+		local = registry.back().get();
+		local->id = static_cast<uint32_t>(registry.size());
+	}
+
+	return *local;
+}
+
+// outcome: event added to the summaries and the span ring of local, replacing its oldest span once it is full
+static void store(ThreadTrace& local, const TraceEvent& event)
+{
+	lock_guard<mutex> lock(local.events_mutex);
+
+	local.summaries[event.name].add({ 1, event.duration, event.duration, event.bytes_in, event.bytes_out, event.peak });
+	if (local.events.size() < TRACE_CAPACITY) local.events.push_back(event);
+	else local.events[local.written % TRACE_CAPACITY] = event;
+	local.written++;
+}
+
+// the flag types of MatAllocator changed between opencv 4 releases, so they are taken from the interface itself
+template <typename ACCESS, typename USAGE>
+pair<ACCESS, USAGE> allocator_flags(bool (MatAllocator::*)(UMatData*, ACCESS, USAGE) const);
+using AccessFlags = decltype(allocator_flags(&MatAllocator::allocate))::first_type;
+using UsageFlags = decltype(allocator_flags(&MatAllocator::allocate))::second_type;
+
+// default mat allocator that counts the bytes every thread allocates, the memory itself comes from
+// the standard allocator
+class CountingAllocator : public MatAllocator
+{
+public:
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlags flags,
+		UsageFlags usage) const override
+	{
+		UMatData* u = Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+
+		// releases come back here so they are counted too
+		if (u)
+		{
+			u->currAllocator = this;
+			if (!(u->flags & UMatData::USER_ALLOCATED_DATA)) count(static_cast<int64_t>(u->size));
+		}
+
+		return u;
+	}
+
+	bool allocate(UMatData* u, AccessFlags flags, UsageFlags usage) const override
+	{
+		return Mat::getStdAllocator()->allocate(u, flags, usage);
+	}
+
+	void deallocate(UMatData* u) const override
+	{
+		if (u && !(u->flags & UMatData::USER_ALLOCATED_DATA)) count(-static_cast<int64_t>(u->size));
+		Mat::getStdAllocator()->deallocate(u);
+	}
+
+private:
+	// memory released by another thread than the one that allocated it lowers that thread's count,
+	// peaks are only compared within one thread so the drift never matters
+	static void count(int64_t bytes)
+	{
+		ThreadTrace& local = local_trace();
+		local.allocated += bytes;
+		local.peak = max(local.peak, local.allocated);
+	}
+};
+
+static CountingAllocator counting_allocator;
+
+// outcome: spans are recorded from now on and cv::Mat allocations are counted
+void trace_enable()
+{
+	if (trace_enabled()) return;
+
+	// the epoch is set before the first span can read it
+	trace_epoch = chrono::steady_clock::now();
+	Mat::setDefaultAllocator(&counting_allocator);
+	tracing.store(true);
+}
+
+// outcome: returns whether spans are recorded
+bool trace_enabled()
+{
+	return tracing.load(memory_order_relaxed);
+}
+
+// outcome: returns the microseconds since tracing was enabled
+int64_t trace_now()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - trace_epoch).count();
+}
+
+// assumptions: name: string literal, start and end: values of trace_now
+// outcome: span recorded on the calling thread, for spans that start and end on different threads
+void trace_record(const char* name, int64_t start, int64_t end, uint64_t bytes_in, uint64_t bytes_out)
+{
+	if (!trace_enabled()) return;
+
+	store(local_trace(), { name, start, end - start, bytes_in, bytes_out, 0 });
+}
+
+// outcome: returns a copy of the retained spans of every thread, oldest first, with the id of their thread,
+//	dropped counts the spans overwritten by newer ones
+static vector<pair<uint32_t, TraceEvent>> trace_events(uint64_t& dropped)
+{
+	vector<pair<uint32_t, TraceEvent>> events;
+	dropped = 0;
+	lock_guard<mutex> lock(registry_mutex);
+
+	for (const auto& local: registry)
+	{
+		lock_guard<mutex> events_lock(local->events_mutex);
+		const size_t oldest = local->written > local->events.size() ? local->written % local->events.size() : 0;
+
+		for (size_t i = 0; i < local->events.size(); i++)
+			events.push_back({ local->id, local->events[(oldest + i) % local->events.size()] });
+		dropped += local->written - local->events.size();
+	}
+
+	return events;
+}
+
+// outcome: the retained spans of every thread written to path as chrome trace event json, returns false when the
+//	file cannot be written
+bool trace_export(const string& path)
+{
+	ofstream file(path);
+	if (!file)
+	{
+		printf("trace write failure:%s\n", path.c_str());
+		return false;
+	}
+
+	// complete events, names are literals that never need escaping
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+
+	uint64_t dropped;
+	for (const auto& [thread, event]: trace_events(dropped))
+	{
+		file << (first ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+			<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration << ",\"args\":{\"bytes_in\":" << event.bytes_in
+			<< ",\"bytes_out\":" << event.bytes_out << ",\"peak_bytes\":" << event.peak << "}}";
+		first = false;
+	}
+	file << "\n]}\n";
+	if (dropped > 0) printf("trace kept the latest %zu spans per thread, %llu older ones were dropped\n", TRACE_CAPACITY,
+		static_cast<unsigned long long>(dropped));
+
+	if (!file) printf("trace write failure:%s\n", path.c_str());
+	return static_cast<bool>(file);
+}
+
+// outcome: count, total, mean and max time, bytes and peak allocation of every span name printed as a table
+void trace_summary()
+{
+	// the same name may be a different literal in every translation unit
+	map<string, TraceSummary> summaries;
+	{
+		lock_guard<mutex> lock(registry_mutex);
+		for (const auto& local: registry)
+		{
+			lock_guard<mutex> events_lock(local->events_mutex);
+			for (const auto& [name, summary]: local->summaries) summaries[name].add(summary);
+		}
+	}
+
+	printf("%-20s %8s %12s %10s %10s %12s %12s %12s\n", "span", "count", "total ms", "mean ms", "max ms", "MB in", "MB out", "peak MB");
+	for (const auto& [name, summary]: summaries)
+		printf("%-20s %8zu %12.3f %10.3f %10.3f %12.2f %12.2f %12.2f\n", name.c_str(), summary.count, summary.total / 1e3,
+			summary.total / 1e3 / summary.count, summary.longest / 1e3, summary.bytes_in / 1e6, summary.bytes_out / 1e6,
+			summary.peak / 1e6);
+}
+
+// assumptions: name: string literal
+TraceScope::TraceScope(const char* name, uint64_t bytes_in)
+	: name(name), enabled(trace_enabled()), in(bytes_in)
+{
+	if (!enabled) return;
+
+	// the thread peak restarts at the current count so the scope sees only its own high water mark
+	ThreadTrace& local = local_trace();
+	allocated = local.allocated;
+	outer_peak = local.peak;
+	local.peak = local.allocated;
+	start = trace_now();
+}
+
+// outcome: span recorded with the bytes the scope produced, when tracing is enabled
+TraceScope::~TraceScope()
+{
+	if (!enabled) return;
+
+	const int64_t end = trace_now();
+	ThreadTrace& local = local_trace();
+	const int64_t peak = local.peak - allocated;
+	local.peak = max(outer_peak, local.peak);
+
+	store(local, { name, start, end - start, in, out, peak });
+}
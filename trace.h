@@ -0,0 +1,61 @@
+// 11 2019, Authors:
+//	Jeremy Deng
+//	Erik Maldonado
+
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+// stage tracing, off until trace_enable is called
+//	every span records wall time, bytes in and out and the peak of cv::Mat memory allocated by its thread,
+//	spans are appended to a bounded ring per thread so recording never contends and a long running process keeps
+//	only the latest spans for export, the summary totals every span, a disabled scope costs one load
+
+// outcome: spans are recorded from now on and cv::Mat allocations are counted
+void trace_enable();
+
+// outcome: returns whether spans are recorded
+bool trace_enabled();
+
+// outcome: returns the microseconds since tracing was enabled
+int64_t trace_now();
+
+// assumptions: name: string literal, start and end: values of trace_now
+// outcome: span recorded on the calling thread, for spans that start and end on different threads
+void trace_record(const char* name, int64_t start, int64_t end, uint64_t bytes_in, uint64_t bytes_out);
+
+// outcome: the retained spans of every thread written to path as chrome trace event json, returns false when the
+//	file cannot be written
+bool trace_export(const std::string& path);
+
+// outcome: count, total, mean and max time, bytes and peak allocation of every span name printed as a table
+void trace_summary();
+
+// span covering the lifetime of the scope
+class TraceScope
+{
+public:
+	// assumptions: name: string literal
+	TraceScope(const char* name, uint64_t bytes_in = 0);
+
+	// outcome: span recorded with the bytes the scope produced, when tracing is enabled
+	~TraceScope();
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	// outcome: bytes counted as input or output of the span
+	void bytes_in(uint64_t bytes) { in = bytes; }
+	void bytes_out(uint64_t bytes) { out = bytes; }
+
+private:
+	const char* name;
+	bool enabled;
+	int64_t start = 0;
+	int64_t allocated = 0;
+	int64_t outer_peak = 0;
+	uint64_t in;
+	uint64_t out = 0;
+};